@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -8,6 +8,10 @@
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
+// * To overlap several transfers, start each with breadstart,
+//     bwritestart or bstartv, then bwait for each one.
+//     bstartv sends runs of consecutive blocks to the disk
+//     as single requests.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -22,70 +26,387 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "stat.h"
 
-struct {
+#define NBUCKET 13
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+// Buffers are hashed by (dev, blockno) into buckets, each with
+// its own lock and LRU list, so lookups of different blocks
+// don't contend. A buffer's refcnt and list links are protected
+// by its bucket's lock.
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of the bucket's buffers, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+};
+
+// Beyond the NBUF static buffers, the cache grows a kalloc()
+// page of buffers at a time while memory is plentiful, and
+// gives idle pages back when kalloc() runs out.
+struct bufpage {
+  struct bufpage *next;
+  struct buf buf[(PGSIZE - sizeof(struct bufpage*)) / sizeof(struct buf)];
+};
+#define BUFPERPAGE NELEM(((struct bufpage*)0)->buf)
+
+struct {
+  // Serializes moving buffers between buckets, so that a
+  // thread holds at most one bucket lock unless it holds this.
+  // Also protects pages and nbuf.
+  struct spinlock lock;
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  struct bufpage *pages;
+  int nbuf;
+
+  // bget() sleeps on freegen, under waitlock, when every buffer
+  // is in use; a buffer whose last reference goes bumps it.
+  struct spinlock waitlock;
+  uint freegen;
+  int waiters;
+
+  uint64 hits, misses, evictions, grows, shrinks, readaheads;
 } bcache;
 
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Insert b at the most recently used end of bk's list.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.waitlock, "bcache.wait");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Spread the buffers over the buckets; bget() moves
+  // them to where they are needed.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bpush(&bcache.bucket[(b - bcache.buf) % NBUCKET], b);
+  }
+  bcache.nbuf = NBUF;
+
+  if(sizeof(struct bufpage) > PGSIZE)
+    panic("binit: bufpage");
+}
+
+// Add a page of buffers to bk, if memory is plentiful or, when
+// every buffer is in use, if there is any memory at all.
+// Returns 0 if it didn't. Called with no bcache locks held,
+// since kalloc() may call bshrink().
+static int
+bgrow(struct bucket *bk, int force)
+{
+  struct bufpage *pg;
+  struct buf *b;
+
+  if(!force && kfreepages() <= BCACHE_MINFREE)
+    return 0;
+  if((pg = kalloc()) == 0)
+    return 0;
+  memset(pg, 0, sizeof(*pg));
+  for(b = pg->buf; b < pg->buf+BUFPERPAGE; b++)
+    initsleeplock(&b->lock, "buffer");
+
+  acquire(&bcache.lock);
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  bcache.nbuf += BUFPERPAGE;
+  bcache.grows++;
+  acquire(&bk->lock);
+  for(b = pg->buf; b < pg->buf+BUFPERPAGE; b++)
+    bpush(bk, b);
+  release(&bk->lock);
+  release(&bcache.lock);
+  return 1;
+}
+
+// A buffer's last reference has gone; wake up bget()s
+// waiting for one. Called with no bcache locks held.
+static void
+bfreed(void)
+{
+  __sync_fetch_and_add(&bcache.freegen, 1);
+  if(__sync_fetch_and_add(&bcache.waiters, 0) > 0){
+    acquire(&bcache.waitlock);
+    wakeup(&bcache.freegen);
+    release(&bcache.waitlock);
+  }
+}
+
+// Sleep until a buffer has been freed since freegen was gen.
+static void
+bwaitfree(uint gen)
+{
+  acquire(&bcache.waitlock);
+  __sync_fetch_and_add(&bcache.waiters, 1);
+  while(__sync_fetch_and_add(&bcache.freegen, 0) == gen)
+    sleep(&bcache.freegen, &bcache.waitlock);
+  __sync_fetch_and_sub(&bcache.waiters, 1);
+  release(&bcache.waitlock);
+}
+
+// Would npinned pinned buffers leave too few for the rest of
+// the system? True once they are half of a cache that memory
+// is too short to grow.
+int
+bcrowded(int npinned)
+{
+  return kfreepages() <= BCACHE_MINFREE && 2 * npinned >= bcache.nbuf;
+}
+
+// Give up to npages pages of idle buffers back to kalloc().
+// Returns the number of pages freed.
+int
+bshrink(int npages)
+{
+  struct bufpage *pg, **pp, *freed = 0;
+  struct buf *b;
+  int i, n = 0;
+
+  if(bcache.pages == 0)
+    return 0;
+
+  acquire(&bcache.lock);
+  for(i = 0; i < NBUCKET; i++)
+    acquire(&bcache.bucket[i].lock);
+  for(pp = &bcache.pages; *pp && n < npages; ){
+    pg = *pp;
+    for(b = pg->buf; b < pg->buf+BUFPERPAGE; b++)
+      if(b->refcnt != 0)
+        break;
+    if(b < pg->buf+BUFPERPAGE){
+      pp = &pg->next;
+      continue;
+    }
+    for(b = pg->buf; b < pg->buf+BUFPERPAGE; b++)
+      bunlink(b);
+    *pp = pg->next;
+    pg->next = freed;
+    freed = pg;
+    n++;
   }
+  bcache.nbuf -= n * BUFPERPAGE;
+  bcache.shrinks += n;
+  for(i = NBUCKET-1; i >= 0; i--)
+    release(&bcache.bucket[i].lock);
+  release(&bcache.lock);
+
+  while((pg = freed) != 0){
+    freed = pg->next;
+    kfree(pg);
+  }
+  return n;
+}
+
+void
+bstat(struct bcstat *st)
+{
+  acquire(&bcache.lock);
+  st->hits = bcache.hits;
+  st->misses = bcache.misses;
+  st->evictions = bcache.evictions;
+  st->grows = bcache.grows;
+  st->shrinks = bcache.shrinks;
+  st->readaheads = bcache.readaheads;
+  st->nbuf = bcache.nbuf;
+  release(&bcache.lock);
+  st->freepages = kfreepages();
+}
+
+// Find a cached buffer for the block in bk's list.
+// bk->lock must be held.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Find the least recently used unused buffer in bk's list.
+// bk->lock must be held.
+static struct buf*
+blru(struct bucket *bk)
+{
+  struct buf *b;
+
+  for(b = bk->head.prev; b != &bk->head; b = b->prev)
+    if(b->refcnt == 0)
+      return b;
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For readahead, return 0 instead if the block is already
+// cached or there is no free buffer.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int readahead)
 {
   struct buf *b;
+  struct bucket *bk = &bcache.bucket[BHASH(dev, blockno)];
+  struct bucket *victim;
+  int i;
+  uint gen;
 
-  acquire(&bcache.lock);
+again:
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(readahead){
+      release(&bk->lock);
+      return 0;
     }
+    b->refcnt++;
+    release(&bk->lock);
+    __sync_fetch_and_add(&bcache.hits, 1);
+    acquiresleep(&b->lock);
+    return b;
   }
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  // Recycle the least recently used (LRU) unused buffer
+  // in this bucket.
+  if((b = blru(bk)) != 0)
+    goto found;
+  release(&bk->lock);
+
+  // Rather than evict a block cached elsewhere,
+  // grow the cache if there is memory to spare.
+  bgrow(bk, 0);
+  gen = __sync_fetch_and_add(&bcache.freegen, 0);
+
+  // None here; steal one from another bucket. Another
+  // thread may cache the block while no lock is held,
+  // so look again once we hold bcache.lock.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(readahead){
+      release(&bk->lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      return 0;
+    }
+    b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    __sync_fetch_and_add(&bcache.hits, 1);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  if((b = blru(bk)) != 0){
+    release(&bcache.lock);
+    goto found;
+  }
+  for(i = 1; i < NBUCKET; i++){
+    victim = &bcache.bucket[(bk - bcache.bucket + i) % NBUCKET];
+    acquire(&victim->lock);
+    if((b = blru(victim)) != 0){
+      bunlink(b);
+      release(&victim->lock);
+      bpush(bk, b);
+      release(&bcache.lock);
+      goto found;
     }
+    release(&victim->lock);
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+  release(&bcache.lock);
+  if(readahead)
+    return 0;
+
+  // Every buffer is in use. Grow the cache even though memory
+  // is short, or else wait for a buffer to be released.
+  if(!bgrow(bk, 1)){
+    log_wantckpt();
+    bwaitfree(gen);
+  }
+  goto again;
+
+found:
+  if(readahead)
+    __sync_fetch_and_add(&bcache.readaheads, 1);
+  else
+    __sync_fetch_and_add(&bcache.misses, 1);
+  if(b->valid)
+    __sync_fetch_and_add(&bcache.evictions, 1);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Unlock b and drop a reference to it.
+// Move to the head of its bucket's most-recently-used list.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+  int idle;
+
+  releasesleep(&b->lock);
+
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
+  b->refcnt--;
+  idle = b->refcnt == 0;
+  if (idle) {
+    // no one is waiting for it.
+    bunlink(b);
+    bpush(bk, b);
+  }
+  
+  release(&bk->lock);
+  if(idle)
+    bfreed();
+}
+
+// Return a locked buf for the indicated block, starting a
+// disk read if it isn't cached. Call bwait() before using
+// b->data.
+struct buf*
+breadstart(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  if(!b->valid)
+    virtio_submit(b, 0, 0);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,14 +415,135 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
-  if(!b->valid) {
-    virtio_disk_rw(b, 0);
-    b->valid = 1;
-  }
+  b = breadstart(dev, blockno);
+  bwait(b);
+  return b;
+}
+
+// Return a locked buf for the indicated block, filled with
+// zeroes instead of read from the disk, for a caller that is
+// about to give the block new contents.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
   return b;
 }
 
+// Start transfers of the n locked bufs in bs to (write) or
+// from the disk, without waiting for them; bwait() for each.
+// Reads skip bufs that are already valid.
+void
+bstartv(struct buf **bs, int n, int write)
+{
+  int i, j;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bstartv");
+
+  for(i = 0; i < n; i = j){
+    if(!write && bs[i]->valid){
+      j = i + 1;
+      continue;
+    }
+    for(j = i + 1; j < n; j++)
+      if(!write && bs[j]->valid)
+        break;
+    virtio_submitv(bs+i, j-i, write, 0);
+  }
+}
+
+// Return locked bufs in bs holding the n blocks starting at
+// blockno, reading the uncached ones in as few requests as
+// possible.
+void
+breadv(uint dev, uint blockno, int n, struct buf **bs)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    bs[i] = bget(dev, blockno+i, 0);
+  bstartv(bs, n, 0);
+  for(i = 0; i < n; i++)
+    bwait(bs[i]);
+}
+
+// Start the readahead of the n bufs in bs, which bget() has
+// claimed, or give them back if the disk queue is short.
+static void
+breadstartv(struct buf **bs, int n)
+{
+  int i;
+
+  if(virtio_trysubmitv(bs, n, 0, breaddone) == 0)
+    return;
+  for(i = 0; i < n; i++)
+    brelse(bs[i]);
+  __sync_fetch_and_sub(&bcache.readaheads, n);
+}
+
+// Start reading the n indicated blocks into the cache, those
+// that aren't there already, without waiting for the disk.
+// A bread() of one of them meanwhile waits for its read.
+// Readahead is only a hint: if no buffer is free, or the disk
+// has too few free descriptors, the blocks are left to be read
+// on demand.
+void
+breadahead(uint dev, uint *blocks, int n)
+{
+  struct buf *b, *bs[MAXREADAHEAD];
+  int i, nb = 0;
+
+  for(i = 0; i < n; i++){
+    if((b = bget(dev, blocks[i], 1)) == 0)
+      continue;
+    bs[nb++] = b;
+    if(nb == NELEM(bs)){
+      breadstartv(bs, nb);
+      nb = 0;
+    }
+  }
+  if(nb > 0)
+    breadstartv(bs, nb);
+}
+
+// Called by virtio_disk_intr() when the read started by
+// breadahead() is done. b was locked by whichever process
+// started the read, so this can't use brelse().
+void
+breaddone(struct buf *b)
+{
+  b->valid = 1;
+  bput(b);
+}
+
+// Start writing b's contents to disk.  Must be locked.
+// b must stay locked until bwait(b) returns.
+void
+bwritestart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwritestart");
+
+  virtio_submit(b, 1, 0);
+}
+
+// Wait for the transfer started on b to finish.  Must be locked.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+
+  virtio_disk_wait(b);
+  b->valid = 1;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -109,47 +551,38 @@ bwrite(struct buf *b)
   if(!holdingsleep(&b->lock))
     panic("bwrite");
 
-  virtio_disk_rw(b, 1);
+  bwritestart(b);
+  bwait(b);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
-  releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  int idle;
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  idle = b->refcnt == 0;
+  release(&bk->lock);
+  if(idle)
+    bfreed();
 }
-
-
-
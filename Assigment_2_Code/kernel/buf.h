@@ -5,8 +5,10 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint logged; // copies in the on-disk or in-memory log, each pinning it
+  struct buf *prev; // LRU list of its hash bucket
   struct buf *next;
+  struct buf *qnext; // next buf in the same disk request
   uchar data[BSIZE];
 };
 
@@ -13,19 +13,23 @@ struct spinlock cow_lock;
 // Max number of pages a CoW group of processes can share
 #define SHMEM_MAX 100
 
+// Max number of CoW groups; independent of NPROC so that
+// raising the process limit does not grow this table.
+#define NCOWGROUP 64
+
 struct cow_group {
     int group; // group id
     uint64 shmem[SHMEM_MAX]; // list of pages a CoW group share
     int count; // Number of active processes
 };
 
-struct cow_group cow_group[NPROC];
+struct cow_group cow_group[NCOWGROUP];
 
 struct cow_group* get_cow_group(int group) {
     if(group == -1)
         return 0;
 
-    for(int i = 0; i < NPROC; i++) {
+    for(int i = 0; i < NCOWGROUP; i++) {
         if(cow_group[i].group == group)
             return &cow_group[i];
     }
@@ -33,7 +37,7 @@ struct cow_group* get_cow_group(int group) {
 }
 
 void cow_group_init(int groupno) {
-    for(int i = 0; i < NPROC; i++) {
+    for(int i = 0; i < NCOWGROUP; i++) {
         if(cow_group[i].group == -1) {
             cow_group[i].group = groupno;
             return;
@@ -82,7 +86,7 @@ int is_shmem(int group, uint64 pa) {
 }
 
 void cow_init() {
-    for(int i = 0; i < NPROC; i++) {
+    for(int i = 0; i < NCOWGROUP; i++) {
         cow_group[i].count = 0;
         cow_group[i].group = -1;
         for(int j = 0; j < SHMEM_MAX; j++)
@@ -0,0 +1,182 @@
+// Directory name cache.
+//
+// Caches the results of directory lookups: which inode number
+// name has in directory dir, or, in a negative entry, that dir
+// has no entry name. dirlookup() consults it before scanning
+// the directory, and fills it in after.
+//
+// Interface:
+// * dcache_lookup returns 1 and sets *inum (0 if negative)
+//     if (dev, dir, name) is cached, else 0.
+// * dcache_enter records the result of a lookup, or a new entry.
+// * dcache_forget drops the entry for a name that is removed.
+// * dcache_purge drops all entries of a directory being freed,
+//     whose inode number may be reused.
+//
+// Callers hold the directory's inode lock, which orders the
+// cache updates for one directory with its lookups; the cache's
+// own spinlock only protects its lists.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+
+#define NDBUCKET 61
+
+struct dentry {
+  uint dev;
+  uint dir;             // inode number of the directory
+  char name[DIRSIZ];
+  uint inum;            // 0 if dir has no entry name
+  struct dentry *hnext; // hash chain; 0 ends it
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+  int used;             // on a hash chain?
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDCACHE];
+  struct dentry *bucket[NDBUCKET];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used, head.prev is least.
+  struct dentry head;
+} dcache;
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h = dev * 31 + dir;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDBUCKET;
+}
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.entry; d < dcache.entry+NDCACHE; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+// Move d to the most recently used end of the list.
+static void
+dtouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Find the entry for (dev, dir, name).
+// Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.bucket[dhash(dev, dir, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Take d off its hash chain and make it the next one reused.
+// Caller holds dcache.lock.
+static void
+dremove(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.bucket[dhash(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->used = 0;
+  d->prev->next = d->next;
+  d->next->prev = d->prev;
+  d->prev = dcache.head.prev;
+  d->next = &dcache.head;
+  dcache.head.prev->next = d;
+  dcache.head.prev = d;
+}
+
+int
+dcache_lookup(uint dev, uint dir, char *name, uint *inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  d = dfind(dev, dir, name);
+  if(d){
+    *inum = d->inum;
+    dtouch(d);
+  }
+  release(&dcache.lock);
+  return d != 0;
+}
+
+void
+dcache_enter(uint dev, uint dir, char *name, uint inum)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) == 0){
+    // Recycle the least recently used entry.
+    d = dcache.head.prev;
+    if(d->used)
+      dremove(d);
+    d->dev = dev;
+    d->dir = dir;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(dev, dir, d->name);
+    d->hnext = dcache.bucket[h];
+    dcache.bucket[h] = d;
+    d->used = 1;
+  }
+  d->inum = inum;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+void
+dcache_forget(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) != 0)
+    dremove(d);
+  release(&dcache.lock);
+}
+
+void
+dcache_purge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.entry; d < dcache.entry+NDCACHE; d++)
+    if(d->used && d->dev == dev && d->dir == dir)
+      dremove(d);
+  release(&dcache.lock);
+}
@@ -1,3 +1,5 @@
+struct bcstat;
+struct logstat;
 struct buf;
 struct context;
 struct file;
@@ -9,6 +11,9 @@ struct sleeplock;
 struct stat;
 struct superblock;
 struct cow_group;
+struct vmshare;
+struct spawn_fa;
+struct iovec;
 
 // cow.c
 struct cow_group* get_cow_group(int group);
@@ -25,10 +30,21 @@ void copy_on_write(struct proc *p, uint64 vaddr);
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     breadstart(uint, uint);
+struct buf*     bnew(uint, uint);
+void            bwritestart(struct buf*);
+void            bwait(struct buf*);
+void            breadahead(uint, uint*, int);
+void            breadv(uint, uint, int, struct buf**);
+void            bstartv(struct buf**, int, int);
+void            breaddone(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(int);
+int             bcrowded(int);
+void            bstat(struct bcstat*);
 
 // console.c
 void            consoleinit(void);
@@ -37,20 +53,28 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
-int             fileread(struct file*, uint64, int n);
+int             fileread(struct file*, int, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int);
 int             filestat(struct file*, uint64 addr);
-int             filewrite(struct file*, uint64, int n);
+int             filewrite(struct file*, int, uint64, int n);
+int             filewritev(struct file*, int, struct iovec*, int);
+int             filesplice(struct file*, struct file*, int n);
 
 // fs.c
 void            fsinit(int);
+void            bcommitstart(void);
+void            bcommitdone(void);
 int             dirlink(struct inode*, char*, uint);
+int             dirempty(struct inode*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
@@ -67,6 +91,13 @@ void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcache_lookup(uint, uint, char*, uint*);
+void            dcache_enter(uint, uint, char*, uint);
+void            dcache_forget(uint, uint, char*);
+void            dcache_purge(uint, uint);
+
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
@@ -76,18 +107,30 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+int             kfreepages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_maxop(void);
+int             log_holds(struct buf*);
+void            log_force(void);
+void            log_wantckpt(void);
+void            logstat(struct logstat*);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+int             pipebeginread(struct pipe*, char**, int, int);
+void            pipeendread(struct pipe*, int);
+int             pipebeginwrite(struct pipe*, char**, int);
+void            pipeendwrite(struct pipe*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -98,10 +141,18 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(int);
+int             clone(uint64, uint64, uint64);
+int             join(int);
+int             spawn(char*, char**, struct spawn_fa*, int);
+int             setaffinity(int, uint64);
+void            kthread(void (*)(void), char*);
+void            proc_lockvm(struct proc*);
+void            proc_unlockvm(struct proc*);
+void            proc_syncsz(struct proc*);
+int             proc_unshare(struct proc*);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(struct proc*, pagetable_t, uint64);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -119,6 +170,7 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            clear_heap_tracker(struct proc*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -154,6 +206,9 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// sysfile.c
+void            fdrelease(void);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
@@ -169,6 +224,7 @@ void            uartputc_sync(int);
 int             uartgetc(void);
 
 // vm.c
+extern pagetable_t kernel_pagetable;
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
@@ -197,6 +253,10 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_submit(struct buf *, int, void (*)(struct buf *));
+void            virtio_submitv(struct buf **, int, int, void (*)(struct buf *));
+int             virtio_trysubmitv(struct buf **, int, int, void (*)(struct buf *));
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // CSE 536: pfault.c
@@ -22,6 +22,21 @@ int flags2perm(int flags)
 
 int
 exec(char *path, char **argv)
+{
+  struct proc *p = myproc();
+
+  // other threads may still be running in the old image.
+  if(proc_unshare(p) < 0)
+    return -1;
+
+  return execproc(p, path, argv);
+}
+
+// Load the program at path into p, replacing p's user memory,
+// if it has any. p is either the caller (exec) or a new child
+// that is not yet runnable (spawn).
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -30,7 +45,6 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 	
 	init_psa_regions();
 	
@@ -96,7 +110,6 @@ exec(char *path, char **argv)
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -151,22 +164,17 @@ exec(char *path, char **argv)
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  if(oldpagetable)
+    proc_freepagetable(p, oldpagetable, oldsz);
 
   // CSE 536: Clear all heap track regions
-  for (int i = 0; i < MAXHEAP; i++) {
-    p->heap_tracker[i].addr            = 0xFFFFFFFFFFFFFFFF;
-    p->heap_tracker[i].startblock      = -1;
-    p->heap_tracker[i].last_load_time  = 0xFFFFFFFFFFFFFFFF;
-    p->heap_tracker[i].loaded          = false;
-  }
-  p->resident_heap_pages = 0;
+  clear_heap_tracker(p);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
-    proc_freepagetable(pagetable, sz);
+    proc_freepagetable(0, pagetable, sz);
   if(ip){
     iunlockput(ip);
     end_op();
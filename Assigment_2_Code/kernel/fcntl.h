@@ -3,3 +3,23 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// spawn() file actions, applied in order to the child's
+// copy of the parent's open files before it starts.
+#define SPAWN_DUP2  1   // make newfd refer to fd's file
+#define SPAWN_CLOSE 2   // close fd
+#define SPAWN_MAXFA 16  // max file actions per spawn()
+
+struct spawn_fa {
+  int op;
+  int fd;
+  int newfd;
+};
+
+// One buffer of a readv() or writev().
+#define IOV_MAX 16      // max buffers per readv()/writev()
+
+struct iovec {
+  void *base;
+  int len;
+};
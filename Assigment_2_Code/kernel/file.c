@@ -12,6 +12,9 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct devsw devsw[NDEV];
 struct {
@@ -102,9 +105,10 @@ filestat(struct file *f, uint64 addr)
 }
 
 // Read from file f.
-// addr is a user virtual address.
+// addr is a user virtual address if user_dst is 1,
+// else a kernel address.
 int
-fileread(struct file *f, uint64 addr, int n)
+fileread(struct file *f, int user_dst, uint64 addr, int n)
 {
   int r = 0;
 
@@ -112,14 +116,14 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user_dst, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user_dst, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, user_dst, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
   } else {
@@ -129,50 +133,148 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Read from file f into the cnt user buffers in iov, in order,
+// stopping at the first one not filled. Only the first piece
+// waits for a pipe to have data.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, m, tot = 0;
+  uint64 base;
+  char *p;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_DEVICE &&
+     (f->major < 0 || f->major >= NDEV || !devsw[f->major].read))
+    return -1;
+
+  if(f->type == FD_INODE)
+    ilock(f->ip);
+  for(i = 0; i < cnt; i++){
+    base = (uint64)iov[i].base;
+    if(f->type == FD_PIPE){
+      m = 0;
+      for(r = 0; r < iov[i].len; r += m){
+        if((m = pipebeginread(f->pipe, &p, iov[i].len - r, tot + r == 0)) <= 0)
+          break;
+        if(copyout(myproc()->pagetable, base + r, p, m) < 0){
+          pipeendread(f->pipe, 0);
+          m = -1;
+          break;
+        }
+        pipeendread(f->pipe, m);
+      }
+      if(m < 0 && r == 0)
+        r = -1;
+    } else if(f->type == FD_DEVICE){
+      r = devsw[f->major].read(1, base, iov[i].len);
+    } else if(f->type == FD_INODE){
+      if((r = readi(f->ip, 1, base, f->off, iov[i].len)) > 0)
+        f->off += r;
+    } else {
+      panic("filereadv");
+    }
+    if(r < 0){
+      tot = tot > 0 ? tot : -1;
+      break;
+    }
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  if(f->type == FD_INODE)
+    iunlock(f->ip);
+
+  return tot;
+}
+
 // Write to file f.
-// addr is a user virtual address.
+// addr is a user virtual address if user_src is 1,
+// else a kernel address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+filewrite(struct file *f, int user_src, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  iov.base = (void*)addr;
+  iov.len = n;
+  return filewritev(f, user_src, &iov, 1);
+}
+
+// Write the cnt buffers in iov to file f, in order, as one
+// write() of all of them would. For an inode, the pieces share
+// FS system calls: each writes as much as one may, however it
+// is divided among the buffers.
+// The buffers are user virtual addresses if user_src is 1,
+// else kernel addresses.
+int
+filewritev(struct file *f, int user_src, struct iovec *iov, int cnt)
+{
+  int i, r = 0, n = 0, ret = 0;
 
   if(f->writable == 0)
     return -1;
+  if(f->type == FD_DEVICE &&
+     (f->major < 0 || f->major >= NDEV || !devsw[f->major].write))
+    return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
-      return -1;
-    ret = devsw[f->major].write(1, addr, n);
+  for(i = 0; i < cnt; i++)
+    n += iov[i].len;
+
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    for(i = 0; i < cnt && ret >= 0; i++){
+      if(f->type == FD_PIPE){
+        r = pipewrite(f->pipe, user_src, (uint64)iov[i].base, iov[i].len);
+      } else {
+        r = devsw[f->major].write(user_src, (uint64)iov[i].base, iov[i].len);
+      }
+      if(r < 0)
+        ret = ret > 0 ? ret : -1;
+      else
+        ret += r;
+      if(r != iov[i].len)
+        break;
+    }
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
+    // write as many blocks at a time as one FS system
+    // call may reserve in the log, including
     // i-node, indirect block, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
+    // writei() seldom logs file blocks, so most of the
+    // reservation goes unused and is handed back.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
+    int nop = log_maxop();
+    int max = ((nop-1-1-2) / 2) * BSIZE;
+    int done = 0;  // bytes of iov[i] written
+    int room, n1 = 0;
+    i = 0;
+    while(i < cnt){
+      begin_opn(nop);
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      for(room = max; i < cnt && room > 0; room -= n1){
+        n1 = min(iov[i].len - done, room);
+        if ((r = writei(f->ip, user_src, (uint64)iov[i].base + done, f->off, n1)) > 0)
+          f->off += r;
+        if(r != n1)
+          break;
+        ret += r;
+        done += r;
+        if(done == iov[i].len){
+          i++;
+          done = 0;
+        }
+      }
       iunlock(f->ip);
-      end_op();
+      end_opn(nop);
 
       if(r != n1){
         // error from writei
         break;
       }
-      i += r;
     }
-    ret = (i == n ? n : -1);
+    ret = (ret == n ? n : -1);
   } else {
     panic("filewrite");
   }
@@ -180,3 +282,59 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Move up to n bytes from in to out without copying them through
+// user space. A pipe's ring is read or written in place, with a
+// single copy to or from the other file (for an inode, straight
+// between the ring and the buffer cache); between two files
+// that aren't pipes the bytes go through one kernel page.
+// Like read(), stops early at end of file, and once it has moved
+// something from a pipe or device that has no more for now.
+// Returns the number of bytes moved, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *p, *page = 0;
+  int m, r = 0, tot = 0;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  // the write would wait for room that only a read of
+  // the same pipe, which this one holds off, can make.
+  if(in->type == FD_PIPE && out->type == FD_PIPE && in->pipe == out->pipe)
+    return -1;
+
+  while(tot < n){
+    if(in->type == FD_PIPE){
+      if((m = pipebeginread(in->pipe, &p, n - tot, tot == 0)) <= 0){
+        r = m;
+        break;
+      }
+      r = filewrite(out, 0, (uint64)p, m);
+      pipeendread(in->pipe, r > 0 ? r : 0);
+    } else if(out->type == FD_PIPE){
+      if((m = pipebeginwrite(out->pipe, &p, n - tot)) < 0){
+        r = -1;
+        break;
+      }
+      r = fileread(in, 0, (uint64)p, m);
+      pipeendwrite(out->pipe, r > 0 ? r : 0);
+    } else {
+      if(page == 0 && (page = kalloc()) == 0){
+        r = -1;
+        break;
+      }
+      m = min(n - tot, PGSIZE);
+      if((r = fileread(in, 0, (uint64)page, m)) > 0 &&
+         filewrite(out, 0, (uint64)page, r) != r)
+        r = -1;
+    }
+    if(r <= 0)
+      break;
+    tot += r;
+    if(in->type == FD_DEVICE || r < m)
+      break;
+  }
+  if(page)
+    kfree(page);
+  return tot > 0 ? tot : r;
+}
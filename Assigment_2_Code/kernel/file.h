@@ -18,6 +18,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;   // itable hash chain
+  struct inode *prev;    // itable LRU list of unreferenced inodes
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +29,17 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  struct extent ext[NEXTENT];
+  uint indirect;
+
+  uint xbn;           // file block at which extent x starts
+  struct extent x;    // extent bmap() found last; len 0 if none
+
+  uint ra_next;       // block after the last one readi() read
+  uint ra_ahead;      // block after the last one read ahead
+  uint ra_win;        // readahead window in blocks; 0 if random
+
+  uint dfree;         // directories: no free entry before this offset
 };
 
 // map major device number to device functions.
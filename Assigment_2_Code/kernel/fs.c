@@ -37,6 +37,8 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void bsuminit(int);
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,6 +46,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
 }
 
 // Zero a block.
@@ -52,36 +55,138 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  bp = bnew(dev, bno);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// bsum summarizes each bitmap block: how many blocks it
+// marks free, and a hint below which it marks none free.
+// balloc() skips full bitmap blocks without reading them
+// and starts each scan at the hint. Both are updated only
+// while holding the bitmap block's buffer, so they agree
+// with the bitmap; bsum.lock protects the arrays themselves.
+//
+// bsum.freed marks the blocks freed by the open transaction
+// and by the one being committed. Until the transaction that
+// frees a block commits, the inode on disk still points at it,
+// so writei() must not write the block in place; balloc()
+// hands out such blocks only when there are no others. Bits
+// of bsum.freed also change only under the bitmap block's
+// buffer lock.
+
+#define NBMAP (FSSIZE/BPB + 1)
+
+struct {
+  struct spinlock lock;
+  int nbmap;              // bitmap blocks in use
+  int nfree[NBMAP];
+  int hint[NBMAP];
+  uint freed[2][NBMAP][BPB/32];  // by the open, committing transaction
+} bsum;
+
+// Number of bitmap bits of bitmap block i that name blocks.
+static int
+bbits(int i)
+{
+  return min(BPB, sb.size - i*BPB);
+}
+
+// Return the first block that bitmap block i, with contents
+// data, marks free, at or after bit from, or -1. Unless any
+// is set, passes over blocks freed by uncommitted transactions.
+// Scans a word at a time.
+static int
+bscan(int i, uchar *data, int from, int any)
+{
+  uint *w = (uint*)data;
+  uint x;
+  int j, bi;
+
+  for(j = from/32; j*32 < bbits(i); j++){
+    x = w[j];
+    if(!any)
+      x |= bsum.freed[0][i][j] | bsum.freed[1][i][j];
+    x = ~x;
+    if(j == from/32)
+      x &= ~0U << (from%32);
+    if(x == 0)
+      continue;
+    for(bi = j*32; (x & 1) == 0; bi++)
+      x >>= 1;
+    return bi < bbits(i) ? bi : -1;
+  }
+  return -1;
+}
 
-// Allocate a zeroed disk block.
+static void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  int i, bi;
+
+  initlock(&bsum.lock, "bsum");
+  bsum.nbmap = (sb.size + BPB - 1) / BPB;
+  if(bsum.nbmap > NBMAP)
+    panic("bsuminit: file system too big");
+  for(i = 0; i < bsum.nbmap; i++){
+    bp = bread(dev, sb.bmapstart + i);
+    bsum.hint[i] = bscan(i, bp->data, 0, 1);
+    if(bsum.hint[i] < 0)
+      bsum.hint[i] = bbits(i);
+    for(bi = bsum.hint[i]; bi < bbits(i); bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[i]++;
+    brelse(bp);
+  }
+}
+
+// Allocate a disk block, the first free one at or after
+// goal, wrapping around to the start. Its contents are
+// whatever the disk holds; the caller must set all of them.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  int i, n, any, bi, from, nfree;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
+  if(goal >= sb.size)
+    goal = 0;
+  for(any = 0; any < 2; any++){
+    for(n = 0; n < bsum.nbmap; n++){
+      i = (goal/BPB + n) % bsum.nbmap;
+      acquire(&bsum.lock);
+      nfree = bsum.nfree[i];
+      release(&bsum.lock);
+      if(nfree == 0)
+        continue;
+
+      bp = bread(dev, sb.bmapstart + i);
+      acquire(&bsum.lock);
+      from = bsum.hint[i];
+      release(&bsum.lock);
+      // in goal's bitmap block, first try at or after goal.
+      bi = -1;
+      if(n == 0 && goal%BPB > from)
+        bi = bscan(i, bp->data, goal%BPB, any);
+      if(bi < 0)
+        bi = bscan(i, bp->data, from, any);
+      if(bi >= 0){
+        bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
         log_write(bp);
+        acquire(&bsum.lock);
+        bsum.nfree[i]--;
+        if(bi == bsum.hint[i])
+          bsum.hint[i] = bi + 1;
+        release(&bsum.lock);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        return i*BPB + bi;
       }
+      brelse(bp);
     }
-    brelse(bp);
   }
   printf("balloc: out of blocks\n");
   return 0;
@@ -101,9 +206,55 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  bsum.freed[0][b/BPB][bi/32] |= 1U << (bi%32);
+  acquire(&bsum.lock);
+  bsum.nfree[b/BPB]++;
+  if(bi < bsum.hint[b/BPB])
+    bsum.hint[b/BPB] = bi;
+  release(&bsum.lock);
   brelse(bp);
 }
 
+// Was block b freed by a transaction that hasn't committed?
+static int
+bpending(int dev, uint b)
+{
+  struct buf *bp;
+  uint bi, m;
+  int r;
+
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1U << (bi%32);
+  r = ((bsum.freed[0][b/BPB][bi/32] | bsum.freed[1][b/BPB][bi/32]) & m) != 0;
+  brelse(bp);
+  return r;
+}
+
+// Called by the log when the open transaction starts to
+// commit. No FS system calls are in progress.
+void
+bcommitstart(void)
+{
+  memmove(bsum.freed[1], bsum.freed[0], sizeof(bsum.freed[0]));
+  memset(bsum.freed[0], 0, sizeof(bsum.freed[0]));
+}
+
+// Called by the log once the committing transaction is on
+// disk: the blocks it freed may now be written in place.
+void
+bcommitdone(void)
+{
+  struct buf *bp;
+  int i;
+
+  for(i = 0; i < bsum.nbmap; i++){
+    bp = bread(ROOTDEV, sb.bmapstart + i);
+    memset(bsum.freed[1][i], 0, sizeof(bsum.freed[1][i]));
+    brelse(bp);
+  }
+}
+
 // Inodes.
 //
 // An inode describes a single unnamed file.
@@ -130,9 +281,9 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
+//   may be recycled if ip->ref is zero. Otherwise ip->ref
+//   tracks the number of in-memory pointers to the entry
+//   (open files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
 //   decrements ref.
 //
@@ -140,7 +291,8 @@ bfree(int dev, uint b)
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid if it frees the inode. An unreferenced entry
+//   stays valid until iget() recycles it.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -172,20 +324,101 @@ bfree(int dev, uint b)
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// The table is hashed by (dev, inum). An entry whose ref falls
+// to zero keeps its inode, still valid, on an LRU list, so
+// that a later iget() of it needn't read it from disk again;
+// iget() recycles the least recently used one. Beyond the
+// NINODE static entries, the table grows a kalloc() page of
+// entries at a time while memory is plentiful, up to one entry
+// per inode on the disk.
+
+#define NIHASH 31
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
+struct inodepage {
+  struct inodepage *next;
+  struct inode inode[(PGSIZE - sizeof(struct inodepage*)) / sizeof(struct inode)];
+};
+#define INODEPERPAGE NELEM(((struct inodepage*)0)->inode)
 
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+
+  // Linked list of unreferenced entries, through prev/next.
+  // head.next is most recently used, head.prev is least.
+  struct inode head;
+  struct inodepage *pages;
+  int ninode;
 } itable;
 
+// Insert ip at the most recently used end of the LRU list.
+static void
+ipush(struct inode *ip)
+{
+  ip->next = itable.head.next;
+  ip->prev = &itable.head;
+  itable.head.next->prev = ip;
+  itable.head.next = ip;
+}
+
+// Insert ip at the least recently used end, to be recycled first.
+static void
+ipushlru(struct inode *ip)
+{
+  ip->next = &itable.head;
+  ip->prev = itable.head.prev;
+  itable.head.prev->next = ip;
+  itable.head.prev = ip;
+}
+
+static void
+iunlink(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  itable.head.prev = &itable.head;
+  itable.head.next = &itable.head;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
+    ipush(&itable.inode[i]);
+  }
+  itable.ninode = NINODE;
+
+  if(sizeof(struct inodepage) > PGSIZE)
+    panic("iinit: inodepage");
+}
+
+// Add a page of entries to the LRU list, if memory is
+// plentiful and the table could use them.
+// Caller holds itable.lock.
+static void
+igrow(void)
+{
+  struct inodepage *pg;
+  struct inode *ip;
+
+  if(itable.ninode >= sb.ninodes || kfreepages() <= BCACHE_MINFREE)
+    return;
+  if((pg = kalloc()) == 0)
+    return;
+  memset(pg, 0, sizeof(*pg));
+  pg->next = itable.pages;
+  itable.pages = pg;
+  itable.ninode += INODEPERPAGE;
+  for(ip = pg->inode; ip < pg->inode+INODEPERPAGE; ip++){
+    initsleeplock(&ip->lock, "inode");
+    ipushlru(ip);
   }
 }
 
@@ -235,7 +468,8 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  dip->indirect = ip->indirect;
   log_write(bp);
   brelse(bp);
 }
@@ -246,31 +480,39 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        iunlink(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used unreferenced entry,
+  // unless the table can grow instead.
+  igrow();
+  ip = itable.head.prev;
+  if(ip == &itable.head)
     panic("iget: no inodes");
+  iunlink(ip);
+  if(ip->inum != 0){
+    for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -308,8 +550,14 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    ip->indirect = dip->indirect;
     brelse(bp);
+    ip->x.len = 0;
+    ip->ra_next = 0;
+    ip->ra_ahead = 0;
+    ip->ra_win = 0;
+    ip->dfree = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -348,6 +596,8 @@ iput(struct inode *ip)
     release(&itable.lock);
 
     itrunc(ip);
+    if(ip->type == T_DIR)
+      dcache_purge(ip->dev, ip->inum);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
@@ -357,7 +607,12 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->valid)
+      ipush(ip);
+    else
+      ipushlru(ip);  // nothing worth keeping
+  }
   release(&itable.lock);
 }
 
@@ -372,52 +627,117 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
-
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// in runs of consecutive blocks on the disk, called extents.
+// The first NEXTENT extents are listed in ip->ext[], the rest
+// in a chain of extent blocks starting at ip->indirect. An
+// extent of length 0 ends the list. Files only grow at the
+// end, so there are no holes.
+
+// Return the disk block address of the nth block in inode ip,
+// and in *run, if run is not 0, the number of blocks from there
+// to the end of its extent, which follow it on disk.
+// If there is no such block, bmap allocates one, next to the
+// last block if it can, to extend the last extent. New blocks
+// of regular files are not zeroed on disk.
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, uint *run)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint i, n, fbn, addr, *next;
+  struct extent *ext, *e, *prev;
+  struct buf *bp, *pbp, *nbp;
+
+  // sequential access stays in the extent found last time.
+  if(bn >= ip->xbn && bn < ip->xbn + ip->x.len){
+    if(run)
+      *run = ip->xbn + ip->x.len - bn;
+    return ip->x.start + bn - ip->xbn;
+  }
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[bn] = addr;
+  // bp holds the extent block being searched, pbp the
+  // one holding prev, the extent before e; 0 for the inode.
+  bp = pbp = 0;
+  ext = ip->ext;
+  n = NEXTENT;
+  next = &ip->indirect;
+  e = prev = 0;
+  fbn = 0;
+  for(;;){
+    for(i = 0; i < n; i++){
+      e = &ext[i];
+      if(e->len == 0)
+        goto append;
+      if(bn < fbn + e->len)
+        goto found;
+      fbn += e->len;
+      prev = e;
+      if(pbp != bp){
+        if(pbp)
+          brelse(pbp);
+        pbp = bp;
+      }
     }
-    return addr;
+    e = 0;
+    if(*next == 0)
+      break;
+    bp = bread(ip->dev, *next);
+    ext = ((struct extblock*)bp->data)->ext;
+    n = NIEXTENT;
+    next = &((struct extblock*)bp->data)->next;
   }
-  bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
+append:
+  if(bn != fbn)
+    panic("bmap: hole");
+  addr = balloc(ip->dev, prev ? prev->start + prev->len : 0);
+  if(addr == 0)
+    goto out;
+  // writei() fills in new blocks of regular files itself;
+  // directories expect free dirents.
+  if(ip->type != T_FILE)
+    bzero(ip->dev, addr);
+  if(prev && addr == prev->start + prev->len){
+    e = prev;
+    fbn -= e->len;
+    e->len++;
+    if(pbp)
+      log_write(pbp);
+    goto found;
+  }
+  if(e == 0){
+    // All extent slots are in use; chain a new extent block.
+    if((*next = balloc(ip->dev, addr)) == 0){
+      bfree(ip->dev, addr);
+      addr = 0;
+      goto out;
     }
-    brelse(bp);
-    return addr;
+    if(bp)
+      log_write(bp);
+    nbp = bnew(ip->dev, *next);
+    if(pbp && pbp != bp)
+      brelse(pbp);
+    pbp = bp;
+    bp = nbp;
+    e = ((struct extblock*)bp->data)->ext;
   }
+  e->start = addr;
+  e->len = 1;
+  if(bp)
+    log_write(bp);
 
-  panic("bmap: out of range");
+found:
+  ip->xbn = fbn;
+  ip->x = *e;
+  if(run)
+    *run = fbn + e->len - bn;
+  addr = e->start + bn - fbn;
+
+out:
+  if(pbp && pbp != bp)
+    brelse(pbp);
+  if(bp)
+    brelse(bp);
+  return addr;
 }
 
 // Truncate inode (discard contents).
@@ -425,28 +745,29 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
+  int i;
+  uint b, next;
   struct buf *bp;
-  uint *a;
+  struct extblock *eb;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  for(i = 0; i < NEXTENT; i++){
+    for(b = 0; b < ip->ext[i].len; b++)
+      bfree(ip->dev, ip->ext[i].start + b);
   }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(next = ip->indirect; next; ){
+    bp = bread(ip->dev, next);
+    eb = (struct extblock*)bp->data;
+    for(i = 0; i < NIEXTENT; i++){
+      for(b = 0; b < eb->ext[i].len; b++)
+        bfree(ip->dev, eb->ext[i].start + b);
     }
+    bfree(ip->dev, next);
+    next = eb->next;
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  memset(ip->ext, 0, sizeof(ip->ext));
+  ip->indirect = 0;
+  ip->x.len = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -464,6 +785,56 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Called by readi() before it reads blocks [bn, end) of ip.
+// Starts disk reads of those blocks and, if the read is
+// sequential (it starts where the last one stopped, or in
+// that one's last block), of up to ra_win blocks past them.
+// The window doubles with each sequential read and closes
+// on any other. readi()'s bread()s then wait for blocks
+// that are already on their way.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn, uint end)
+{
+  uint b, last, nblocks, addrs[MAXREADAHEAD];
+  int n = 0;
+
+  if(bn == ip->ra_next || bn + 1 == ip->ra_next){
+    if(ip->ra_win == 0)
+      ip->ra_win = 2;
+    else if(ip->ra_win < MAXREADAHEAD)
+      ip->ra_win *= 2;
+    // no need to start blocks that are already under way.
+    if(ip->ra_ahead > bn && ip->ra_ahead <= end + ip->ra_win)
+      bn = ip->ra_ahead;
+  } else {
+    ip->ra_win = 0;
+  }
+  ip->ra_next = end;
+
+  // Only blocks inside the file, so bmap() won't allocate.
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  last = end + ip->ra_win;
+  if(last > nblocks)
+    last = nblocks;
+  for(b = bn; b < last; ){
+    uint run, addr = bmap(ip, b, &run);
+    if(addr == 0)
+      break;
+    for(; run > 0 && b < last; run--, b++){
+      addrs[n++] = addr++;
+      if(n == NELEM(addrs)){
+        breadahead(ip->dev, addrs, n);
+        n = 0;
+      }
+    }
+  }
+  if(n > 0)
+    breadahead(ip->dev, addrs, n);
+  if(b > ip->ra_ahead || ip->ra_win == 0)
+    ip->ra_ahead = b;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -471,17 +842,22 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, run;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
-
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
+  if(n > 0)
+    readahead(ip, off/BSIZE, (off + n + BSIZE - 1)/BSIZE);
+
+  // every pass but the last ends at a block boundary, so
+  // the next one is in the following block, and in the same
+  // extent until the run runs out.
+  run = 0;
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m, addr++, run--){
+    if(run == 0 && (addr = bmap(ip, off/BSIZE, &run)) == 0)
       break;
     bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -502,43 +878,93 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // Returns the number of bytes successfully written.
 // If the return value is less than the requested n,
 // there was an error of some kind.
+// Write the n locked bufs in bs to disk and release them.
+static void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  bstartv(bs, n, 1);
+  for(i = 0; i < n; i++){
+    bwait(bs[i]);
+    brelse(bs[i]);
+  }
+}
+
+// The content of a regular file is written in place, not
+// logged (see log.c), in batches of up to MAXWRITEBEHIND
+// blocks, before writei() returns and so before the
+// transaction that allocated the blocks commits.
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, addr, run;
+  struct buf *bp, *bs[MAXWRITEBEHIND];
+  int nb, new, inplace;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
+  run = 0;
+  nb = 0;
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m, addr++, run--){
+    if(run == 0 && (addr = bmap(ip, off/BSIZE, &run)) == 0)
       break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
+    // a file block past the old end of the file holds nothing
+    // yet, so it needn't be read, only zeroed in memory.
+    new = ip->type == T_FILE && off - off%BSIZE >= ip->size;
+    bp = new ? bnew(ip->dev, addr) : bread(ip->dev, addr);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
-    log_write(bp);
-    brelse(bp);
+    inplace = ip->type == T_FILE && !log_holds(bp) &&
+      !(new && bpending(ip->dev, addr));
+    if(!inplace){
+      log_write(bp);
+      brelse(bp);
+      continue;
+    }
+    bs[nb++] = bp;
+    if(nb == MAXWRITEBEHIND){
+      bwritev(bs, nb);
+      nb = 0;
+    }
   }
+  bwritev(bs, nb);
 
   if(off > ip->size)
     ip->size = off;
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
+  // block to ip->ext[].
   iupdate(ip);
 
   return tot;
 }
 
 // Directories
+//
+// A directory is an array of dirents; inum 0 marks a free one.
+// Small directories are scanned linearly. When a one-block
+// directory fills up, dirlink() converts it into a hashed one
+// (extendible hashing), in which a lookup reads one bucket:
+//   block 0: ".", "..", a dirhead with the global depth
+//            and the number of entries
+//   block 1: the index, 2^depth bucket block numbers
+//   blocks 2..: buckets, each a dirhead with its local depth
+//            and up to BSIZE/sizeof(struct dirent)-1 entries
+// A full bucket is split in two, doubling the index first if
+// its local depth is the global depth. dirlink() splits at most
+// once, so a create still writes only a few blocks.
+// Directories bigger than one block that were written linearly
+// stay linear.
+
+#define DPB (BSIZE / sizeof(struct dirent))  // dirents per block
 
 int
 namecmp(const char *s, const char *t)
@@ -546,31 +972,254 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+static uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Return block fbn of directory dp, which must exist.
+static struct buf*
+dirblock(struct inode *dp, uint fbn)
+{
+  uint addr;
+
+  if((addr = bmap(dp, fbn, 0)) == 0)
+    panic("dirblock");
+  return bread(dp->dev, addr);
+}
+
+// Return the global depth of directory dp, or -1 if it is linear.
+// Caller must hold dp->lock.
+static int
+dirdepth(struct inode *dp)
+{
+  struct buf *bp;
+  struct dirhead *h;
+  int depth;
+
+  if(dp->size < 4*BSIZE)
+    return -1;
+  bp = dirblock(dp, 0);
+  h = (struct dirhead*)bp->data + 2;
+  depth = (h->inum == 0 && h->magic == DIRMAGIC) ? h->depth : -1;
+  brelse(bp);
+  return depth;
+}
+
+// Return the block number of the bucket for names hashing to h.
+static uint
+dirbucket(struct inode *dp, uint h, int depth)
+{
+  struct buf *bp;
+  uint j, b;
+
+  j = h & ((1 << depth) - 1);
+  bp = dirblock(dp, 1);
+  b = ((struct dirindex*)bp->data)[j / DIRIPE].bucket[j % DIRIPE];
+  brelse(bp);
+  return b;
+}
+
+// Add delta to the entry count of hashed directory dp.
+static void
+dircount(struct inode *dp, int delta)
+{
+  struct buf *bp;
+
+  bp = dirblock(dp, 0);
+  ((struct dirhead*)bp->data + 2)->nent += delta;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Scan the entries of directory dp in [off, end), a block at
+// a time, for the first one named name, or the first free one
+// if name is 0. Returns its offset, or end if there is none,
+// and sets *inum to its inode number.
+// Caller must hold dp->lock.
+static uint
+dirscan(struct inode *dp, uint off, uint end, char *name, uint *inum)
+{
+  uint addr, run, bend;
+  struct buf *bp;
+  struct dirent *de;
+
+  run = 0;
+  while(off < end){
+    if(run == 0 && (addr = bmap(dp, off/BSIZE, &run)) == 0)
+      panic("dirscan");
+    bp = bread(dp->dev, addr);
+    bend = min(end, (off/BSIZE + 1) * BSIZE);
+    for(; off < bend; off += sizeof(*de)){
+      de = (struct dirent*)(bp->data + off%BSIZE);
+      if(name ? de->inum != 0 && namecmp(name, de->name) == 0 : de->inum == 0){
+        *inum = de->inum;
+        brelse(bp);
+        return off;
+      }
+    }
+    brelse(bp);
+    addr++;
+    run--;
+  }
+  return end;
+}
+
+// Turn dp, a full one-block linear directory, into a hashed
+// one with two buckets. Returns 0, or -1 if out of blocks.
+static int
+dirconvert(struct inode *dp)
+{
+  struct buf *bp[4];
+  struct dirent *de, *to;
+  struct dirhead *h;
+  struct dirindex *idx;
+  int i, n[2];
+  uint b;
+
+  for(i = 1; i < 4; i++)
+    if(bmap(dp, i, 0) == 0)
+      return -1;
+  for(i = 0; i < 4; i++)
+    bp[i] = dirblock(dp, i);
+
+  n[0] = n[1] = 1;
+  de = (struct dirent*)bp[0]->data;
+  for(i = 2; i < DPB; i++){
+    b = dirhash(de[i].name) & 1;
+    to = (struct dirent*)bp[2+b]->data + n[b]++;
+    *to = de[i];
+    memset(&de[i], 0, sizeof(de[i]));
+  }
+  for(i = 0; i < 3; i++){
+    h = (struct dirhead*)bp[i == 0 ? 0 : i+1]->data + (i == 0 ? 2 : 0);
+    h->magic = DIRMAGIC;
+    h->depth = 1;
+    h->nent = i == 0 ? DPB - 2 : 0;
+  }
+  idx = (struct dirindex*)bp[1]->data;
+  idx[0].bucket[0] = 2;
+  idx[0].bucket[1] = 3;
+  for(i = 0; i < 4; i++){
+    log_write(bp[i]);
+    brelse(bp[i]);
+  }
+  dp->size = 4*BSIZE;
+  iupdate(dp);
+  return 0;
+}
+
+// Split bucket b of hashed directory dp, of global depth depth,
+// by moving the entries whose hash has the next bit set to a new
+// bucket at the end of dp. Returns the new global depth, or -1
+// if the bucket can't be split or out of blocks.
+static int
+dirsplit(struct inode *dp, uint b, int depth)
+{
+  struct buf *ob, *nb, *ib, *hb;
+  struct dirhead *oh, *nh;
+  struct dirent *de, *ne;
+  struct dirindex *idx;
+  uint nbk, addr, j;
+  int ld, i, n;
+
+  ob = dirblock(dp, b);
+  oh = (struct dirhead*)ob->data;
+  ld = oh->depth;
+  if(ld == depth && depth == DIRMAXDEPTH){
+    brelse(ob);
+    return -1;
+  }
+  nbk = dp->size / BSIZE;
+  if((addr = bmap(dp, nbk, 0)) == 0){
+    brelse(ob);
+    return -1;
+  }
+
+  ib = dirblock(dp, 1);
+  idx = (struct dirindex*)ib->data;
+  if(ld == depth){
+    // double the index; both halves name the same buckets.
+    for(j = 0; j < (1 << depth); j++)
+      idx[(j + (1 << depth)) / DIRIPE].bucket[(j + (1 << depth)) % DIRIPE] =
+        idx[j / DIRIPE].bucket[j % DIRIPE];
+    depth++;
+    hb = dirblock(dp, 0);
+    ((struct dirhead*)hb->data + 2)->depth = depth;
+    log_write(hb);
+    brelse(hb);
+  }
+  for(j = 0; j < (1 << depth); j++)
+    if(idx[j / DIRIPE].bucket[j % DIRIPE] == b && (j >> ld) & 1)
+      idx[j / DIRIPE].bucket[j % DIRIPE] = nbk;
+  log_write(ib);
+  brelse(ib);
+
+  nb = bread(dp->dev, addr);
+  nh = (struct dirhead*)nb->data;
+  nh->magic = DIRMAGIC;
+  nh->depth = oh->depth = ld + 1;
+  de = (struct dirent*)ob->data;
+  ne = (struct dirent*)nb->data;
+  n = 1;
+  for(i = 1; i < DPB; i++){
+    if(de[i].inum != 0 && (dirhash(de[i].name) >> ld) & 1){
+      ne[n++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  log_write(nb);
+  brelse(nb);
+  log_write(ob);
+  brelse(ob);
+
+  dp->size += BSIZE;
+  iupdate(dp);
+  return depth;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Lookups that don't need the offset go through the name cache.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint off, end, inum, b;
+  int depth;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  if(poff == 0 && dcache_lookup(dp->dev, dp->inum, name, &inum))
+    return inum ? iget(dp->dev, inum) : 0;
+
+  if((depth = dirdepth(dp)) < 0){
+    off = 0;
+    end = dp->size;
+  } else if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    off = 0;
+    end = 2*sizeof(struct dirent);
+  } else {
+    b = dirbucket(dp, dirhash(name), depth);
+    off = b*BSIZE;
+    end = off + BSIZE;
+  }
+  off = dirscan(dp, off, end, name, &inum);
+  if(off < end){
+    // entry matches path element
+    if(poff)
+      *poff = off;
+    dcache_enter(dp->dev, dp->inum, name, inum);
+    return iget(dp->dev, inum);
   }
 
+  dcache_enter(dp->dev, dp->inum, name, 0);
   return 0;
 }
 
@@ -579,7 +1228,8 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off, none, b;
+  int depth;
   struct dirent de;
   struct inode *ip;
 
@@ -589,22 +1239,83 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if((depth = dirdepth(dp)) < 0){
+    // Look for an empty dirent, past the ones known to be used.
+    off = dirscan(dp, dp->dfree, dp->size, 0, &none);
+    if(off == BSIZE && dp->size == BSIZE){
+      if(dirconvert(dp) < 0)
+        return -1;
+      depth = 1;
+    }
+  }
+  if(depth >= 0){
+    // Look for an empty dirent in the name's bucket. If it is
+    // full, split it; that leaves room unless all its names
+    // hash alike.
+    b = dirbucket(dp, dirhash(name), depth);
+    off = dirscan(dp, b*BSIZE + sizeof(de), (b+1)*BSIZE, 0, &none);
+    if(off == (b+1)*BSIZE){
+      if((depth = dirsplit(dp, b, depth)) < 0)
+        return -1;
+      b = dirbucket(dp, dirhash(name), depth);
+      off = dirscan(dp, b*BSIZE + sizeof(de), (b+1)*BSIZE, 0, &none);
+      if(off == (b+1)*BSIZE)
+        return -1;
+    }
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  if(depth >= 0)
+    dircount(dp, 1);
+  else
+    dp->dfree = off + sizeof(de);
+  dcache_enter(dp->dev, dp->inum, name, inum);
 
   return 0;
 }
 
+// Remove the entry for name, at byte offset off, from dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink: writei");
+  if(dirdepth(dp) >= 0)
+    dircount(dp, -1);
+  else if(off < dp->dfree)
+    dp->dfree = off;
+  dcache_forget(dp->dev, dp->inum, name);
+}
+
+// Is the directory dp empty except for "." and ".." ?
+int
+dirempty(struct inode *dp)
+{
+  uint off, inum;
+  struct buf *bp;
+  int n;
+
+  if(dirdepth(dp) >= 0){
+    bp = dirblock(dp, 0);
+    n = ((struct dirhead*)bp->data + 2)->nent;
+    brelse(bp);
+    return n == 0;
+  }
+  for(off = 2*sizeof(struct dirent); off < dp->size; off += sizeof(struct dirent)){
+    if(readi(dp, 0, (uint64)&inum, off, sizeof(ushort)) != sizeof(ushort))
+      panic("dirempty: readi");
+    if((ushort)inum != 0)
+      return 0;
+  }
+  return 1;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -655,8 +1366,13 @@ namex(char *path, int nameiparent, char *name)
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    struct fdtable *fdt = myproc()->fdt;
+    // another thread may chdir() meanwhile.
+    acquire(&fdt->lock);
+    ip = idup(fdt->cwd);
+    release(&fdt->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -27,9 +27,25 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+// A file's content is a list of extents, each a run of len
+// consecutive disk blocks starting at start, in file order.
+struct extent {
+  uint start;
+  uint len;
+};
+
+#define NEXTENT 6   // extents in the inode
+#define NIEXTENT (BSIZE / sizeof(struct extent) - 1)  // in an extent block
+#define MAXFILE 4096  // max file size in blocks
+
+// Extents past the first NEXTENT are kept in a chain of
+// extent blocks, so even a badly fragmented file can grow
+// to MAXFILE blocks.
+struct extblock {
+  struct extent ext[NIEXTENT];
+  uint next;            // Next extent block, or 0
+  uint unused;
+};
 
 // On-disk inode structure
 struct dinode {
@@ -38,7 +54,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent ext[NEXTENT];  // First extents of the content
+  uint indirect;        // First extent block, or 0
 };
 
 // Inodes per block.
@@ -61,3 +78,27 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory that outgrows one block is hashed: block 0 holds
+// ".", ".." and a dirhead, block 1 the index, and the rest are
+// buckets, each starting with a dirhead. Both kinds of entry
+// have inum 0, so they read as free dirents.
+#define DIRMAGIC 0x4844
+#define DIRMAXDEPTH 8    // at most 2^8 buckets
+#define DIRIPE 7         // index entries per dirindex
+
+struct dirhead {
+  ushort inum;           // always 0
+  ushort magic;          // DIRMAGIC
+  ushort depth;          // global depth in block 0, else local
+  ushort nent;           // block 0: entries in all the buckets
+  uint unused[2];
+};
+
+// Index entry j, at dirindex[j/DIRIPE].bucket[j%DIRIPE] in
+// block 1, is the block number of the bucket holding the
+// names whose hash is j modulo 2^depth.
+struct dirindex {
+  ushort inum;           // always 0
+  ushort bucket[DIRIPE];
+};
+
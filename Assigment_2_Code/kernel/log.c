@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "stat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -17,68 +18,245 @@
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// the count of in-progress FS system calls, reserves log
+// space for MAXOPBLOCKS blocks and returns. But if it thinks
+// the log is close to running out, it sleeps until the last
+// outstanding end_op() commits. Large writes reserve more
+// with begin_opn()/end_opn().
+//
+// Commits are grouped: the last outstanding end_op() only
+// commits if another system call's blocks might not fit in
+// the log. Otherwise the transaction stays open for more
+// system calls, and the logd kernel thread commits it once
+// it has been open LOGCOMMITTICKS ticks. fsync() commits at
+// once.
+//
+// The log is double-buffered in memory: a commit first copies
+// the blocks of the open transaction aside (no FS system calls
+// run while it does), then hands the open header over to the
+// committing one and lets system calls start the next
+// transaction while it writes and installs the copies. Only
+// one commit is on disk at a time; the next one waits for it.
+//
+// Checkpointing is lazy: a commit only appends its blocks to
+// the on-disk log. Installing them at their home locations is
+// left to the ckptd kernel thread, which runs once half of the
+// log is in use and writes each home block once, however many
+// transactions have logged it since the last checkpoint. A
+// commit that does not fit in the log checkpoints first.
+// Committed blocks stay pinned in the buffer cache until they
+// are installed, so ckptd also runs early when they crowd a
+// cache that memory is too short to grow, or when bget() has
+// run out of buffers.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+//   header blocks, containing a count and block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A block may appear more than once, logged by different
+// transactions; the last copy is the newest. mkfs sets the
+// size of the log; the header takes as many of its blocks as
+// needed to list the rest.
+// Log appends are synchronous. The committing transaction is
+// written from its copies straight to the disk, not through the
+// buffer cache, so that newer updates to the same blocks made
+// by the next transaction stay in the cache.
+//
+// Only metadata goes through the log. writei() writes the
+// content of regular files in place, before the transaction
+// that points the inode at it commits (ordered data). A block
+// the log holds a copy of must still be logged, or installing
+// the copy would undo the write; log_holds() says which.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[MAXLOGSIZE];
 };
 
+#define HPB (BSIZE / sizeof(uint))  // header words per block
+
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int nhead;       // header blocks at the start of the log.
+  int cap;         // blocks after the header, for logged blocks.
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by those sys calls.
+  int want;        // log blocks a sleeping begin_opn() needs.
+  int committing;  // a commit is writing the log.
+  int checkpointing; // the log is being installed and emptied.
+  int copying;     // commit is copying the open transaction; please wait.
+  int force;       // fsync() is waiting; commit as soon as possible.
+  int wantckpt;    // bget() is out of buffers; checkpoint now.
+  uint opened;     // ticks when the first block joined the transaction.
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // the open transaction
+  struct logheader clh;  // the transaction being committed
+  struct logheader dh;   // the committed blocks in the on-disk log
+  struct logstat stat;
 };
 struct log log;
 
+// Contents of the blocks in log.clh, as of the start of its commit,
+// or of the blocks being installed by a checkpoint. initlog()
+// allocates log.cap of them, several to a page.
+static struct buf *shadow[MAXLOGSIZE];
+
 static void recover_from_log(void);
 static void commit();
+static void logdaemon(void);
+static void checkpointer(void);
+
+static void
+shadowinit(void)
+{
+  int i, per = PGSIZE / sizeof(struct buf);
+  char *page = 0;
+
+  for (i = 0; i < log.cap; i++) {
+    if (i % per == 0) {
+      if ((page = kalloc()) == 0)
+        panic("initlog: no memory for shadows");
+      memset(page, 0, PGSIZE);
+    }
+    shadow[i] = (struct buf*)page + i % per;
+  }
+}
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
+  int i;
+  struct buf *b;
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  // the header needs a word for the count and one per block.
+  log.nhead = (log.size + 1 + HPB) / (HPB + 1);
+  log.cap = log.size - log.nhead;
+  if (log.size > MAXLOGSIZE || log.cap < 3*MAXOPBLOCKS)
+    panic("initlog: bad log size");
   log.dev = dev;
+  shadowinit();
   recover_from_log();
+  // keep the header cached, so that a checkpoint never
+  // needs a buffer that bget() might have to wait for.
+  for (i = 0; i < log.nhead; i++) {
+    b = bread(dev, log.start + i);
+    bpin(b);
+    brelse(b);
+  }
+  kthread(logdaemon, "logd");
+  kthread(checkpointer, "ckptd");
 }
 
-// Copy committed blocks from log to their home location
+// Read or write the n bufs, which are not in the buffer cache,
+// at the block numbers set in them. Sorts bs so that neighbouring
+// blocks go to disk in one request, and starts all the transfers
+// before waiting for any of them.
 static void
+shadow_rw(struct buf **bs, int n, int write)
+{
+  int i, j;
+  struct buf *b;
+
+  for (i = 1; i < n; i++) {
+    b = bs[i];
+    for (j = i; j > 0 && bs[j-1]->blockno > b->blockno; j--)
+      bs[j] = bs[j-1];
+    bs[j] = b;
+  }
+  for (i = 0; i < n; i++)
+    bs[i]->dev = log.dev;
+  virtio_submitv(bs, n, write, 0);
+  for (i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
+}
+
+// Is block b in the transaction described by h?
+static int
+inlog(struct logheader *h, uint b)
+{
+  int i;
+
+  for (i = 0; i < h->n; i++)
+    if (h->block[i] == b)
+      return 1;
+  return 0;
+}
+
+// Copy the newest committed copy of each block in the on-disk
+// log to its home location, writing each block only once.
+// The copy comes from the buffer cache, unless the open
+// transaction has changed the block since, in which case it is
+// read back from the log. Returns the number of blocks written.
+static int
 install_trans(int recovering)
 {
-  int tail;
+  static struct buf *bs[MAXLOGSIZE], *rs[MAXLOGSIZE];
+  static uint home[MAXLOGSIZE];
+  int i, j, n, nread, newer;
+  struct buf *b;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  n = nread = 0;
+  for (i = log.dh.n-1; i >= 0; i--) {
+    for (j = i+1; j < log.dh.n; j++)
+      if (log.dh.block[j] == log.dh.block[i])
+        break;
+    if (j < log.dh.n)
+      continue;  // a later transaction logged it again
+    home[n] = log.dh.block[i];
+    bs[n] = shadow[n];
+    if (!recovering) {
+      b = bread(log.dev, home[n]); // pinned, so still cached
+      // holding b's lock, no FS system call can change it.
+      acquire(&log.lock);
+      newer = inlog(&log.lh, home[n]);
+      release(&log.lock);
+      if (!newer)
+        memmove(bs[n]->data, b->data, BSIZE);
+      brelse(b);
+      if (!newer) {
+        n++;
+        continue;
+      }
+    }
+    bs[n]->blockno = log.start+log.nhead+i;  // read it from the log
+    rs[nread++] = bs[n];
+    n++;
+  }
+  shadow_rw(rs, nread, 0);
+  for (i = 0; i < n; i++)
+    shadow[i]->blockno = home[i];
+  shadow_rw(bs, n, 1);  // write dsts to disk
+  return n;
+}
+
+// Release the cache blocks of the first n entries of log.dh,
+// once the log that held them has been erased on disk. Until
+// then log_holds() must keep saying yes, or writei() could
+// write a block in place that recovery would overwrite with
+// the older copy in the log.
+static void
+unpin_trans(int n)
+{
+  int i;
+  struct buf *b;
+
+  for (i = 0; i < n; i++) {
+    b = bread(log.dev, log.dh.block[i]);
+    acquire(&log.lock);
+    b->logged--;
+    release(&log.lock);
+    bunpin(b);
+    brelse(b);
   }
 }
 
@@ -86,75 +264,227 @@ install_trans(int recovering)
 static void
 read_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  struct buf *buf = 0;
+  uint *hb;
+  int w;
+
+  for (w = 0; w == 0 || w <= log.dh.n; w++) {
+    if (w % HPB == 0) {
+      if (buf)
+        brelse(buf);
+      buf = bread(log.dev, log.start + w/HPB);
+    }
+    hb = (uint *) (buf->data);
+    if (w == 0)
+      log.dh.n = hb[0];
+    else
+      log.dh.block[w-1] = hb[w % HPB];
+    if (log.dh.n > log.cap)
+      panic("read_head: bad log");
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write header block hblk from the in-memory log header.
 static void
-write_head(void)
+put_head(int hblk)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
+  struct buf *buf = bread(log.dev, log.start+hblk);
+  uint *hb = (uint *) (buf->data);
+  int w;
+
+  for (w = hblk*HPB; w < (hblk+1)*HPB && w <= log.dh.n; w++)
+    hb[w - hblk*HPB] = (w == 0 ? log.dh.n : log.dh.block[w-1]);
   bwrite(buf);
   brelse(buf);
 }
 
+// Write in-memory log header to disk, given that the entries
+// before from are there already. The first header block, with
+// the count, goes last: writing it is the true point at which
+// the current transaction commits.
+static void
+write_head(int from)
+{
+  int hblk;
+
+  hblk = (1 + from) / HPB;
+  for (hblk = (hblk > 0 ? hblk : 1); hblk <= log.dh.n / HPB; hblk++)
+    put_head(hblk);
+  put_head(0);
+}
+
 static void
 recover_from_log(void)
 {
   read_head();
   install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  log.dh.n = 0;
+  write_head(0); // clear the log
 }
 
-// called at the start of each FS system call.
+// Copy the blocks of the open transaction into the shadows.
+// No FS system calls are in progress, so log.lh cannot change.
+static void
+snapshot(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.lh.n; tail++) {
+    struct buf *b = bread(log.dev, log.lh.block[tail]); // cache block
+    memmove(shadow[tail]->data, b->data, BSIZE);
+    brelse(b);
+  }
+}
+
+// Is the log too full to take another FS system call,
+// or the one begin_opn() is waiting to start?
+static int
+logfull(void)
+{
+  return log.lh.n + (log.want > MAXOPBLOCKS ? log.want : MAXOPBLOCKS) > log.cap;
+}
+
+// Is a commit or checkpoint using the on-disk log?
+static int
+logbusy(void)
+{
+  return log.committing || log.checkpointing;
+}
+
+// Should ckptd install the on-disk log? Caller holds log.lock.
+static int
+ckptdue(void)
+{
+  if(log.dh.n == 0)
+    return 0;
+  return 2 * log.dh.n >= log.cap || log.wantckpt || bcrowded(log.dh.n);
+}
+
+// Install the on-disk log and empty it. Caller holds log.lock,
+// and no commit or checkpoint is in progress. FS system calls
+// may run meanwhile. Returns with log.lock held.
+static void
+checkpointlocked(void)
+{
+  int n, ndh;
+
+  log.checkpointing = 1;
+  release(&log.lock);
+  n = install_trans(0);
+  ndh = log.dh.n;
+  log.dh.n = 0;
+  write_head(0);   // Erase the installed transactions from the log
+  unpin_trans(ndh);
+  acquire(&log.lock);
+  log.checkpointing = 0;
+  log.wantckpt = 0;
+  log.stat.checkpoints++;
+  log.stat.installs += n;
+  wakeup(&log);
+}
+
+// Commit the open transaction, and then the next one as well
+// if by the time this one is done it has filled up or fsync()
+// is waiting for it. Caller holds log.lock, and no FS system
+// calls, commit or checkpoint are in progress. Returns with
+// log.lock held.
+static void
+commitlocked(void)
+{
+  do {
+    if(log.dh.n + log.lh.n > log.cap){
+      // no room in the log for this transaction.
+      checkpointlocked();
+      if(log.outstanding > 0)
+        break;  // end_op() or logd will commit.
+    }
+    log.committing = 1;
+    log.copying = 1;
+    if(log.force){
+      log.force = 0;
+      log.stat.forced++;
+    }
+    // call snapshot and commit w/o holding locks, since not
+    // allowed to sleep with locks.
+    release(&log.lock);
+    snapshot();
+    bcommitstart();
+    acquire(&log.lock);
+    log.clh = log.lh;
+    log.lh.n = 0;
+    log.want = 0;  // sleepers in begin_opn() will set it again
+    log.copying = 0;
+    wakeup(&log);  // FS system calls may start the next transaction
+    release(&log.lock);
+    commit();
+    bcommitdone();
+    acquire(&log.lock);
+    log.committing = 0;
+    log.stat.commits++;
+    log.stat.blocks += log.clh.n;
+    wakeup(&log);
+    if(ckptdue())
+      wakeup(&log.dh);  // time for ckptd to install the log
+  } while(log.outstanding == 0 && log.lh.n > 0 && (log.force || logfull()));
+}
+
+// called at the start of an FS system call that may
+// write up to n blocks, at most log_maxop().
 void
-begin_op(void)
+begin_opn(int n)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.copying){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.outstanding == 0 && log.lh.n + n > log.cap && !logbusy()){
+      commitlocked();
+    } else if(log.lh.n + log.reserved + n > log.cap){
       // this op might exhaust log space; wait for commit.
+      if(n > log.want)
+        log.want = n;
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// The most blocks a single FS system call may reserve: a
+// quarter of the log, so that several can share a transaction.
+int
+log_maxop(void)
 {
-  int do_commit = 0;
+  return log.cap / 4;
+}
 
+// called at the end of an FS system call started with
+// begin_opn(n). commits if this was the last outstanding
+// operation, the log is full or fsync() is waiting, and no
+// other commit or checkpoint is in progress; else that one
+// will do it.
+void
+end_opn(int n)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  log.reserved -= n;
+  if(log.copying)
+    panic("log.copying");
+  if(log.outstanding == 0 && log.lh.n > 0 && !logbusy() &&
+     (log.force || logfull())){
+    commitlocked();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,43 +492,138 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Make the effects of all finished FS system calls durable:
+// wait for the commit in progress, and commit the open
+// transaction after it. Also wait for a checkpoint in progress,
+// which may be about to let writei() write blocks in place.
+void
+log_force(void)
+{
+  int target;
+
+  acquire(&log.lock);
+  target = log.stat.commits + log.committing;
+  if(log.lh.n > 0){
+    target++;
+    log.force = 1;
+  }
+  while(log.stat.commits < target || log.checkpointing){
+    if(!logbusy() && log.outstanding == 0 && log.lh.n > 0)
+      commitlocked();
+    else
+      sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
+
+// Kernel thread that commits a transaction once it has been
+// open for LOGCOMMITTICKS ticks and no FS system calls are
+// in progress.
+static void
+logdaemon(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.lh.n > 0 && log.outstanding == 0 && !logbusy() &&
+       ticks - log.opened >= LOGCOMMITTICKS){
+      commitlocked();
+      continue;
+    }
     release(&log.lock);
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+    acquire(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Kernel thread that installs the on-disk log once half of it
+// is in use, so that commits seldom have to wait for it.
+static void
+checkpointer(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(!logbusy() && ckptdue()){
+      checkpointlocked();
+      // a transaction may have been waiting for room.
+      if(log.outstanding == 0 && log.lh.n > 0 && (log.force || logfull()))
+        commitlocked();
+      continue;
+    }
+    sleep(&log.dh, &log.lock);
+  }
+}
+
+// Called by bget() when every buffer is in use: ask ckptd to
+// install the log, which unpins the blocks it holds.
+void
+log_wantckpt(void)
+{
+  acquire(&log.lock);
+  if(log.dh.n > 0){
+    log.wantckpt = 1;
+    wakeup(&log.dh);
+  }
+  release(&log.lock);
+}
+
+// Is a copy of b, which the caller has locked, in the log?
+int
+log_holds(struct buf *b)
+{
+  int r;
+
+  acquire(&log.lock);
+  r = b->logged > 0;
+  release(&log.lock);
+  return r;
+}
+
+void
+logstat(struct logstat *st)
+{
+  acquire(&log.lock);
+  *st = log.stat;
+  release(&log.lock);
+}
+
+// Write the shadows of the committing transaction to the log,
+// after the transactions already there.
 static void
 write_log(void)
 {
+  static struct buf *bs[MAXLOGSIZE];
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < log.clh.n; tail++) {
+    shadow[tail]->blockno = log.start+log.nhead+log.dh.n+tail; // log block
+    bs[tail] = shadow[tail];
   }
+  shadow_rw(bs, log.clh.n, 1);  // write the log
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int tail, from;
+
+  if (log.clh.n > 0) {
+    write_log();     // Write the shadows to the log
+    from = log.dh.n;
+    for (tail = 0; tail < log.clh.n; tail++)
+      log.dh.block[from+tail] = log.clh.block[tail];
+    log.dh.n += log.clh.n;
+    write_head(from); // Write header to disk -- the real commit
   }
 }
 
@@ -217,7 +642,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -228,6 +653,9 @@ log_write(struct buf *b)
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
+    if (log.lh.n == 0)
+      log.opened = ticks;
+    b->logged++;
     bpin(b);
     log.lh.n++;
   }
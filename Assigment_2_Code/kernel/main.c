@@ -26,6 +26,7 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    dcacheinit();    // directory name cache
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
 
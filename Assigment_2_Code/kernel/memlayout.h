@@ -53,6 +53,7 @@
 
 // map kernel stacks beneath the trampoline,
 // each surrounded by invalid guard pages.
+// slots are mapped on demand by allocproc().
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
 // User memory layout.
@@ -62,6 +63,8 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   thread trapframes, one page each, below TRAPFRAME
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define TRAPFRAME_SLOT(i) (TRAPFRAME - (i)*PGSIZE)
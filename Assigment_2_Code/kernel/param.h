@@ -1,21 +1,30 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC       512  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NTHREAD      16  // maximum threads sharing an address space
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // static i-node table entries; it grows beyond
+#define NDCACHE     200  // directory name cache entries
+#define PIPEPAGES     1  // pages of buffer per pipe; a power of two
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define DIROPBLOCKS  (MAXOPBLOCKS+10)  // ... or one whose dirlink() may convert and split a directory
+#define LOGSIZE      1024  // default size of on-disk log (mkfs -l)
+#define MAXLOGSIZE   2048  // max size of on-disk log, header included
+#define NBUF         (MAXOPBLOCKS*3)  // initial size of disk block cache
+#define BCACHE_MINFREE 1024 // buffer cache grows rather than evicts only while more pages are free
+#define BSHRINK_PAGES   8  // pages the buffer cache frees at once when memory runs out
+#define MAXREADAHEAD   16  // max blocks readi() reads ahead of a sequential reader
+#define MAXWRITEBEHIND 8   // max file blocks writei() writes to disk at once
+#define LOGCOMMITTICKS  1  // ticks a transaction may stay open before commit
 // #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
-#define FSSIZE       6000  // size of file system in blocks
+#define FSSIZE      12000  // size of file system in blocks
 
-/* CSE 536: changed to 3000 to use the last 1000 blocks for page swapping. */
-#define PSASTART                33       // Starting page save area (PSA) block
-#define PSAEND                  4032     // Ending page save area (PSA) block
+/* CSE 536: changed to 3000 to use the last 1000 blocks for page swapping.
+ * The PSA starts at sb.swapstart, right after the log. */
 #define PSASIZE                 4000     // total size of the PSA
 
 /* CSE 536: heap-related definitions. */
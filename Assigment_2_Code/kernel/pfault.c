@@ -15,6 +15,8 @@
 int loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz);
 int flags2perm(int flags);
 
+extern struct superblock sb;  // fs.c; the PSA starts at sb.swapstart
+
 /* CSE 536: (2.4) read current time. */
 uint64 read_current_timestamp() {
   uint64 curticks = 0;
@@ -62,13 +64,13 @@ void evict_page_to_disk(struct proc* p) {
     int victimPageIndex = 0;
     uint64 minTime = __UINT64_MAX__;
     for(int i=0; i<MAXHEAP; i++){
-        if(!p->heap_tracker[i].loaded && p->heap_tracker[i].last_load_time < minTime) {
-            minTime = p->heap_tracker[i].last_load_time;
+        if(!HEAPTRACK(p, i)->loaded && HEAPTRACK(p, i)->last_load_time < minTime) {
+            minTime = HEAPTRACK(p, i)->last_load_time;
             victimPageIndex = i;
         }
     }
 
-    uint64 vaAddr = p->heap_tracker[victimPageIndex].addr;
+    uint64 vaAddr = HEAPTRACK(p, victimPageIndex)->addr;
     
     /* Print statement. */
     print_evict_page(vaAddr, blockno);
@@ -80,21 +82,26 @@ void evict_page_to_disk(struct proc* p) {
     
     /* Write to the disk blocks. Below is a template as to how this works. There is
      * definitely a better way but this works for now. :p */
-    struct buf* b;
+    struct buf* b[4];
     for(int i=0; i<4; i++){
-        b = bread(1, PSASTART+(blockno+i));
+        /* The whole block is overwritten; don't read it first. */
+        b[i] = bnew(1, sb.swapstart+blockno+i);
         // Copy page contents to b.data using memmove.
-        memmove(b->data, ptr+(i*1024), 1024);
-        bwrite(b);
-        brelse(b);
+        memmove(b[i]->data, ptr+(i*1024), 1024);
+    }
+    /* The four blocks are consecutive: one disk request. */
+    bstartv(b, 4, 1);
+    for(int i=0; i<4; i++){
+        bwait(b[i]);
+        brelse(b[i]);
     }
 
     /* Unmap swapped out page */
     uvmunmap(p->pagetable, vaAddr, 1, 0);
 
     /* Update the resident heap tracker. */
-    p->heap_tracker[victimPageIndex].startblock = blockno;
-    p->heap_tracker[victimPageIndex].loaded = true;
+    HEAPTRACK(p, victimPageIndex)->startblock = blockno;
+    HEAPTRACK(p, victimPageIndex)->loaded = true;
 }
 
 /* Retrieve faulted page from disk. */
@@ -102,8 +109,8 @@ void retrieve_page_from_disk(struct proc* p, uint64 uvaddr) {
     /* Find where the page is located in disk */
     int startBlockNo=0;
     for(int i=0;i<MAXHEAP;i++){
-        if(p->heap_tracker[i].loaded && p->heap_tracker[i].addr == uvaddr){
-            startBlockNo = p->heap_tracker[i].startblock;
+        if(HEAPTRACK(p, i)->loaded && HEAPTRACK(p, i)->addr == uvaddr){
+            startBlockNo = HEAPTRACK(p, i)->startblock;
             psa_tracker[startBlockNo] = false;
             psa_tracker[startBlockNo+1] = false;
             psa_tracker[startBlockNo+2] = false;
@@ -119,11 +126,11 @@ void retrieve_page_from_disk(struct proc* p, uint64 uvaddr) {
     void* ptr = kalloc();
   
     /* Read the disk block into temp kernel page. */
-    struct buf* b;
+    struct buf* b[4];
+    breadv(1, sb.swapstart+startBlockNo, 4, b);
     for(int i=0; i<4; i++) {
-        b = bread(1, PSASTART+(startBlockNo+i));
-        brelse(b);
-        memmove(ptr+(1024*i), b->data, 1024);
+        memmove(ptr+(1024*i), b[i]->data, 1024);
+        brelse(b[i]);
     }
     
     /* Copy from temp kernel page to uvaddr (use copyout) */
@@ -154,8 +161,8 @@ void page_fault_handler(void)
 
     /* Check if the fault address is a heap page. Use p->heap_tracker */
     for(int i=0;i<MAXHEAP;i++){
-        if(p->heap_tracker[i].addr == faulting_addr){
-            if(p->heap_tracker[i].loaded) load_from_disk = true;
+        if(HEAPTRACK(p, i)->addr == faulting_addr){
+            if(HEAPTRACK(p, i)->loaded) load_from_disk = true;
             goto heap_handle;
         } 
     }
@@ -204,8 +211,8 @@ heap_handle:
    	
     /* 2.4: Update the last load time for the loaded heap page in p->heap_tracker. */
     for(int i=0;i<MAXHEAP;i++){
-        if(p->heap_tracker[i].addr == faulting_addr) {
-            p->heap_tracker[i].last_load_time = read_current_timestamp();
+        if(HEAPTRACK(p, i)->addr == faulting_addr) {
+            HEAPTRACK(p, i)->last_load_time = read_current_timestamp();
             break;
         }
     }
@@ -8,32 +8,74 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The ring buffer is PIPEPAGES whole pages, apart from the
+// page holding struct pipe. Reads and writes copy each
+// contiguous span of it with one copyout()/copyin(); a span
+// ends at the end of the data, of the free space, or of a page.
+#define PIPESIZE (PIPEPAGES*PGSIZE)
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// nread and nwrite wrap at 2^32, so PIPESIZE must divide it
+// for their offsets into the ring to stay continuous.
+#if PIPEPAGES <= 0 || (PIPEPAGES & (PIPEPAGES - 1)) != 0
+#error "PIPEPAGES must be a power of two"
+#endif
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *ring[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rbusy;      // a splice is reading the ring without the lock
+  int wbusy;      // a splice is writing the ring without the lock
 };
 
+// Where byte number off of the data goes in the ring, and
+// how many bytes from there to the end of its page.
+static char*
+pipeaddr(struct pipe *pi, uint off, int *room)
+{
+  off %= PIPESIZE;
+  *room = PGSIZE - off%PGSIZE;
+  return pi->ring[off/PGSIZE] + off%PGSIZE;
+}
+
+static void
+pipefree(struct pipe *pi)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(pi->ring[i])
+      kfree(pi->ring[i]);
+  kfree((char*)pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *pi;
 
+  int i;
+
   pi = 0;
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi->ring, 0, sizeof(pi->ring));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((pi->ring[i] = kalloc()) == 0)
+      goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->rbusy = 0;
+  pi->wbusy = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +89,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,15 +110,18 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Write n bytes from addr, a user virtual address if user_src
+// is 1, else a kernel address.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m, room;
+  char *dst;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -88,12 +133,19 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
+    } else if(pi->wbusy){
+      sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      dst = pipeaddr(pi, pi->nwrite, &room);
+      m = n - i;
+      if(m > room)
+        m = room;
+      if(m > pi->nread + PIPESIZE - pi->nwrite)
+        m = pi->nread + PIPESIZE - pi->nwrite;
+      if(either_copyin(dst, user_src, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -102,29 +154,123 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
   return i;
 }
 
+// Read up to n bytes to addr, a user virtual address if
+// user_dst is 1, else a kernel address.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n)
 {
-  int i;
+  int i, m, room;
+  char *src;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    src = pipeaddr(pi, pi->nread, &room);
+    m = n - i;
+    if(m > room)
+      m = room;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(either_copyout(user_dst, addr + i, src, m) == -1)
       break;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// splice() moves data between the ring and another file
+// without copying it through a buffer of its own: it claims
+// one end of the pipe, and then reads or writes a span of the
+// ring in place, without holding pi->lock since the other file
+// may sleep. Other readers or writers wait until it is done.
+
+// Claim the reading end of pi and return the length of the
+// next span of data, at most n, and in *p where it starts.
+// If wait is 0, returns 0 at once if pi is empty; else waits
+// for data, returning 0 at end of file. Returns -1 if killed.
+// Unless it returns 0 or -1, call pipeendread() afterwards.
+int
+pipebeginread(struct pipe *pi, char **p, int n, int wait)
+{
+  int m, room;
+
+  acquire(&pi->lock);
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen && wait)){
+    if(killed(myproc())){
+      release(&pi->lock);
+      return -1;
+    }
+    sleep(&pi->nread, &pi->lock);
+  }
+  if(pi->nread == pi->nwrite){
+    release(&pi->lock);
+    return 0;
+  }
+  *p = pipeaddr(pi, pi->nread, &room);
+  m = min(min(n, room), pi->nwrite - pi->nread);
+  pi->rbusy = 1;
+  release(&pi->lock);
+  return m;
+}
+
+// The caller of pipebeginread() consumed m bytes of its span.
+void
+pipeendread(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  pi->nread += m;
+  pi->rbusy = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+}
+
+// Claim the writing end of pi, waiting for free space, and
+// return the length of the next span of it, at most n, and in
+// *p where it starts. Returns -1 if the reading end is closed
+// or the caller is killed; otherwise call pipeendwrite().
+int
+pipebeginwrite(struct pipe *pi, char **p, int n)
+{
+  int m, room;
+
+  acquire(&pi->lock);
+  while(pi->wbusy || pi->nwrite == pi->nread + PIPESIZE){
+    if(pi->readopen == 0 || killed(myproc())){
+      release(&pi->lock);
+      return -1;
+    }
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  if(pi->readopen == 0){
+    release(&pi->lock);
+    return -1;
+  }
+  *p = pipeaddr(pi, pi->nwrite, &room);
+  m = min(min(n, room), pi->nread + PIPESIZE - pi->nwrite);
+  pi->wbusy = 1;
+  release(&pi->lock);
+  return m;
+}
+
+// The caller of pipebeginwrite() filled m bytes of its span.
+void
+pipeendwrite(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  pi->nwrite += m;
+  pi->wbusy = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+}
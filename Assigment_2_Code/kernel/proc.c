@@ -3,59 +3,115 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fcntl.h"
 #include "proc.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
+static uint64 onlinecpus;  // CPUs that have entered scheduler()
 
-struct proc proc[NPROC];
+// Process descriptors are kalloc'd on demand, up to NPROC.
+// proc[0..nproc-1] are the ones allocated so far; once
+// allocated, a descriptor and its kernel stack are never
+// freed, only recycled through freeprocs, so a struct proc
+// pointer stays valid for the life of the kernel.
+struct proc *proc[NPROC];
+int nproc;
 
 struct proc *initproc;
 
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Processes hashed by pid, so kill() need not
+// scan the whole table. Chains run through
+// p->hashnext and are protected by pid_lock.
+#define NPIDHASH 64
+#define PIDHASH(pid) ((pid) % NPIDHASH)
+struct proc *pidhash[NPIDHASH];
+
+// UNUSED proc slots, linked through p->freenext,
+// so allocproc() need not scan the whole table.
+// proc_freelock also protects growing proc[].
+struct proc *freeprocs;
+struct spinlock proc_freelock;
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
+// An address space shared by a process and the threads
+// it creates with clone(). Allocated by the first clone();
+// freed, along with the page table, by the last freeproc().
+struct vmshare {
+  struct spinlock lock;        // protects ref, sz, trapframe slots
+  struct sleeplock faultlock;  // serializes page faults
+  int ref;                     // procs using the page table
+  uint64 sz;                   // size of user memory (bytes)
+
+  /* CSE 536: threads share the heap tracker as well. */
+  struct heap_tracker_t *heap_tracker[HEAPTRACK_PAGES];
+};
+
+void uvmfree_cow(pagetable_t, uint64, int);
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
+// Allocate a new process descriptor and a page for its
+// kernel stack. Map the stack high in memory, followed
+// by an invalid guard page.
+// Caller must hold proc_freelock.
+// Returns 0 if NPROC is reached or memory runs out.
+static struct proc*
+newproc(void)
 {
   struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  char *pa;
+
+  if(nproc >= NPROC)
+    return 0;
+  if((p = (struct proc*)kalloc()) == 0)
+    return 0;
+  if((pa = kalloc()) == 0){
+    kfree(p);
+    return 0;
   }
+
+  memset(p, 0, sizeof(*p));
+  initlock(&p->lock, "proc");
+  p->state = UNUSED;
+  p->kstack = KSTACK(nproc);
+  if(mappages(kernel_pagetable, p->kstack, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+    kfree(pa);
+    kfree(p);
+    return 0;
+  }
+  // the stack's va has never been mapped before, so no other
+  // hart can hold a stale TLB entry for it.
+  sfence_vma();
+
+  proc[nproc] = p;
+  __sync_synchronize();
+  nproc++;
+  return p;
 }
 
 // initialize the proc table.
 void
 procinit(void)
 {
-  struct proc *p;
-  
+  if(sizeof(struct proc) > PGSIZE)
+    panic("procinit: struct proc too big");
+
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  initlock(&proc_freelock, "proc_free");
 }
 
 // Must be called with interrupts disabled,
@@ -89,21 +145,68 @@ myproc(void)
   return p;
 }
 
-int
-allocpid()
+// Give p a fresh pid and enter it in the pid hash.
+// p->lock must be held.
+static void
+allocpid(struct proc *p)
 {
-  int pid;
-  
   acquire(&pid_lock);
-  pid = nextpid;
+  p->pid = nextpid;
   nextpid = nextpid + 1;
+  p->hashnext = pidhash[PIDHASH(p->pid)];
+  pidhash[PIDHASH(p->pid)] = p;
   release(&pid_lock);
+}
 
-  return pid;
+// Remove p from the pid hash and clear its pid.
+// p->lock must be held.
+static void
+freepid(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for(pp = &pidhash[PIDHASH(p->pid)]; *pp; pp = &(*pp)->hashnext){
+    if(*pp == p){
+      *pp = p->hashnext;
+      break;
+    }
+  }
+  p->hashnext = 0;
+  p->pid = 0;
+  release(&pid_lock);
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
+// Find the process with the given pid.
+// Returns with p->lock held, or 0 if there is none.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  if(pid <= 0)
+    return 0;
+
+  acquire(&pid_lock);
+  for(p = pidhash[PIDHASH(pid)]; p; p = p->hashnext)
+    if(p->pid == pid)
+      break;
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
+
+  // p may have been freed (and even reused) between
+  // dropping pid_lock and taking p->lock; re-check.
+  acquire(&p->lock);
+  if(p->pid != pid){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
+// Take a proc off the free list.
+// If one is available, initialize state required to run in the kernel,
 // and return with p->lock held.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
@@ -111,19 +214,30 @@ allocproc(void)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
-  }
-  return 0;
+  acquire(&proc_freelock);
+  p = freeprocs;
+  if(p)
+    freeprocs = p->freenext;
+  else
+    p = newproc();
+  release(&proc_freelock);
+  if(p == 0)
+    return 0;
 
-found:
-  p->pid = allocpid();
+  acquire(&p->lock);
+  if(p->state != UNUSED)
+    panic("allocproc: free proc in use");
+  p->freenext = 0;
+  allocpid(p);
   p->state = USED;
+  p->tfva = TRAPFRAME;
+  p->fdt = &p->ownfdt;
+  initlock(&p->fdt->lock, "fdtable");
+  p->fdt->ref = 1;
+
+  // Children inherit their creator's CPU affinity.
+  p->affinity = myproc() ? myproc()->affinity : ~0UL;
+  p->lastcpu = -1;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -132,6 +246,16 @@ found:
     return 0;
   }
 
+  /* CSE 536: pages for the heap tracker. */
+  for(int i = 0; i < HEAPTRACK_PAGES; i++){
+    if((p->heap_tracker[i] = kalloc()) == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+  }
+  clear_heap_tracker(p);
+
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
@@ -149,29 +273,81 @@ found:
   return p;
 }
 
+// Drop p's reference to its shared address space, unmapping
+// its trapframe. The last reference frees the page table,
+// user memory and heap tracker.
+// p->lock must be held.
+static void
+proc_putvm(struct proc *p)
+{
+  struct vmshare *vm = p->vm;
+  int last;
+
+  acquire(&vm->lock);
+  uvmunmap(p->pagetable, p->tfva, 1, 0);
+  vm->ref--;
+  last = (vm->ref == 0);
+  release(&vm->lock);
+
+  if(last){
+    uvmunmap(p->pagetable, TRAMPOLINE, 1, 0);
+    if(p->cow_enabled){
+      uvmfree_cow(p->pagetable, vm->sz, p->cow_group);
+      decr_cow_group_count(p->cow_group);
+    } else
+      uvmfree(p->pagetable, vm->sz);
+  } else {
+    // the heap tracker pages still belong to the others.
+    for(int i = 0; i < HEAPTRACK_PAGES; i++)
+      p->heap_tracker[i] = 0;
+  }
+  if(last)
+    kfree((void*)vm);
+  p->pagetable = 0;
+  p->vm = 0;
+}
+
 // free a proc structure and the data hanging from it,
 // including user pages.
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
 {
+  if(p->vm){
+    proc_putvm(p);
+  } else if(p->pagetable){
+    if(p->cow_enabled) {
+        proc_freepagetable_cow(p->pagetable, p->sz, p->cow_group);
+    } else proc_freepagetable(p, p->pagetable, p->sz);
+  }
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable){
-    if(p->cow_enabled) {
-        proc_freepagetable_cow(p->pagetable, p->sz, p->cow_group);
-    } else proc_freepagetable(p->pagetable, p->sz);
+  for(int i = 0; i < HEAPTRACK_PAGES; i++){
+    if(p->heap_tracker[i])
+      kfree((void*)p->heap_tracker[i]);
+    p->heap_tracker[i] = 0;
   }
   p->pagetable = 0;
   p->sz = 0;
-  p->pid = 0;
+  p->tfva = 0;
+  p->isthread = 0;
+  p->kfn = 0;
+  if(p->pid)
+    freepid(p);
   p->parent = 0;
+  p->children = 0;
+  p->sibling = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
+
+  acquire(&proc_freelock);
+  p->freenext = freeprocs;
+  freeprocs = p;
+  release(&proc_freelock);
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -209,14 +385,16 @@ proc_pagetable(struct proc *p)
 }
 
 // Free a process's page table, and free the
-// physical memory it refers to.
+// physical memory it refers to. p is the process it belonged
+// to, whose CoW group loses a member, or 0 if the page table
+// was never installed in a process (a failed exec or spawn).
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(struct proc *p, pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
   uvmfree(pagetable, sz);
-  if(myproc()->cow_enabled) decr_cow_group_count(myproc() -> cow_group);
+  if(p && p->cow_enabled) decr_cow_group_count(p->cow_group);
 }
 
 // a user program that calls exec("/init")
@@ -251,20 +429,31 @@ userinit(void)
   p->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  p->fdt->cwd = namei("/");
 
   p->state = RUNNABLE;
 
   release(&p->lock);
 }
 
+/* CSE 536: Clear all heap track regions. */
+void clear_heap_tracker(struct proc* p) {
+  for (int i = 0; i < MAXHEAP; i++) {
+    HEAPTRACK(p, i)->addr            = 0xFFFFFFFFFFFFFFFF;
+    HEAPTRACK(p, i)->startblock      = -1;
+    HEAPTRACK(p, i)->last_load_time  = 0xFFFFFFFFFFFFFFFF;
+    HEAPTRACK(p, i)->loaded          = false;
+  }
+  p->resident_heap_pages = 0;
+}
+
 /* CSE 536: tracking each heap page allocated to the process. */
 void track_heap(struct proc* p, uint64 start, int npages) {
   for (int i = 0; i < MAXHEAP; i++) {
-    if (p->heap_tracker[i].addr == 0xFFFFFFFFFFFFFFFF) {
-      p->heap_tracker[i].addr           = start + (i*PGSIZE);
-      p->heap_tracker[i].loaded         = 0;   
-      p->heap_tracker[i].startblock     = -1;
+    if (HEAPTRACK(p, i)->addr == 0xFFFFFFFFFFFFFFFF) {
+      HEAPTRACK(p, i)->addr           = start + (i*PGSIZE);
+      HEAPTRACK(p, i)->loaded         = 0;   
+      HEAPTRACK(p, i)->startblock     = -1;
 
       npages--;
       if (npages == 0) return;
@@ -288,10 +477,18 @@ growproc(int n)
   /* CSE 536: For simplicity, I've made all allocations at page-level. */
   n = PGROUNDUP(n);
 
+  // threads sharing the page table grow it one at a time.
+  if(p->vm){
+    acquire(&p->vm->lock);
+    p->sz = p->vm->sz;
+  }
+
   sz = p->sz;
   if(!p->ondemand) {
     if(n > 0){
       if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+        if(p->vm)
+          release(&p->vm->lock);
         return -1;
       }
     } else if(n < 0){
@@ -303,20 +500,237 @@ growproc(int n)
     
     int num_pages = n / PGSIZE;
     for(int i=0; i<num_pages; i++) {
-      p->heap_tracker[i].addr = sz + i*PGSIZE;
+      HEAPTRACK(p, i)->addr = sz + i*PGSIZE;
     }
     p->sz += n;
   }
+
+  if(p->vm){
+    p->vm->sz = p->sz;
+    release(&p->vm->lock);
+  }
   
   return 0;
 }
 
+// Refresh p->sz, which another thread may have changed.
+void
+proc_syncsz(struct proc *p)
+{
+  if(p->vm){
+    acquire(&p->vm->lock);
+    p->sz = p->vm->sz;
+    release(&p->vm->lock);
+  }
+}
+
+// Page faults in a shared address space must not race to
+// map the same page. Called by usertrap() around the handler.
+void
+proc_lockvm(struct proc *p)
+{
+  if(p->vm)
+    acquiresleep(&p->vm->faultlock);
+}
+
+void
+proc_unlockvm(struct proc *p)
+{
+  if(p->vm)
+    releasesleep(&p->vm->faultlock);
+}
+
+// Return p's shared address space, creating it on
+// the first clone(). Returns 0 if out of memory.
+static struct vmshare*
+proc_getvm(struct proc *p)
+{
+  struct vmshare *vm;
+
+  if(p->vm)
+    return p->vm;
+  if((vm = (struct vmshare*)kalloc()) == 0)
+    return 0;
+  initlock(&vm->lock, "vm");
+  initsleeplock(&vm->faultlock, "vmfault");
+  vm->ref = 1;
+  vm->sz = p->sz;
+  for(int i = 0; i < HEAPTRACK_PAGES; i++)
+    vm->heap_tracker[i] = p->heap_tracker[i];
+  p->vm = vm;
+  return vm;
+}
+
+// Stop sharing p's address space, before exec() replaces it.
+// Returns -1 if other threads are still using it.
+int
+proc_unshare(struct proc *p)
+{
+  struct vmshare *vm = p->vm;
+
+  if(vm == 0)
+    return 0;
+
+  acquire(&vm->lock);
+  if(vm->ref > 1){
+    release(&vm->lock);
+    return -1;
+  }
+  // the page table is ours alone now; move our trapframe
+  // back to TRAPFRAME, where proc_freepagetable() expects it.
+  if(p->tfva != TRAPFRAME){
+    if(mappages(p->pagetable, TRAPFRAME, PGSIZE,
+                (uint64)p->trapframe, PTE_R | PTE_W) != 0){
+      release(&vm->lock);
+      return -1;
+    }
+    uvmunmap(p->pagetable, p->tfva, 1, 0);
+    p->tfva = TRAPFRAME;
+  }
+  p->sz = vm->sz;
+  release(&vm->lock);
+
+  p->vm = 0;
+  kfree((void*)vm);
+  return 0;
+}
+
+// Give np, which has its own empty table, copies of p's
+// open files and current directory.
+static void
+fdtcopy(struct proc *p, struct proc *np)
+{
+  int i;
+
+  acquire(&p->fdt->lock);
+  for(i = 0; i < NOFILE; i++)
+    if(p->fdt->ofile[i])
+      np->fdt->ofile[i] = filedup(p->fdt->ofile[i]);
+  np->fdt->cwd = idup(p->fdt->cwd);
+  release(&p->fdt->lock);
+}
+
+// Close the open files and current directory in p's table,
+// which no other proc is using.
+static void
+fdtclose(struct proc *p)
+{
+  struct fdtable *fdt = p->fdt;
+
+  for(int fd = 0; fd < NOFILE; fd++){
+    if(fdt->ofile[fd]){
+      struct file *f = fdt->ofile[fd];
+      fileclose(f);
+      fdt->ofile[fd] = 0;
+    }
+  }
+
+  begin_op();
+  iput(fdt->cwd);
+  end_op();
+  fdt->cwd = 0;
+}
+
+// Create a new thread sharing the caller's page table, open
+// files and current directory. It starts running fn(arg) on
+// the user stack whose top is stack, with its own trapframe
+// and kernel stack.
+// Returns the new thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, pid, slot;
+  pte_t *pte;
+  struct vmshare *vm;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if(stack % 16 != 0)
+    return -1;
+  if((vm = proc_getvm(p)) == 0)
+    return -1;
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // np runs in our page table, not the one allocproc() made.
+  uvmunmap(np->pagetable, TRAMPOLINE, 1, 0);
+  uvmunmap(np->pagetable, TRAPFRAME, 1, 0);
+  uvmfree(np->pagetable, 0);
+  np->pagetable = 0;
+
+  // Map np's trapframe in the first free slot below ours.
+  acquire(&vm->lock);
+  for(slot = 1; slot < NTHREAD; slot++){
+    pte = walk(p->pagetable, TRAPFRAME_SLOT(slot), 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      break;
+  }
+  if(slot == NTHREAD ||
+     mappages(p->pagetable, TRAPFRAME_SLOT(slot), PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) != 0){
+    release(&vm->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  vm->ref++;
+  np->sz = vm->sz;
+  release(&vm->lock);
+
+  np->pagetable = p->pagetable;
+  np->vm = vm;
+  np->tfva = TRAPFRAME_SLOT(slot);
+  np->isthread = 1;
+
+  /* CSE 536: share the heap tracker, CoW group and on-demand bit. */
+  for(i = 0; i < HEAPTRACK_PAGES; i++){
+    kfree((void*)np->heap_tracker[i]);
+    np->heap_tracker[i] = vm->heap_tracker[i];
+  }
+  np->cow_enabled = p->cow_enabled;
+  np->cow_group = p->cow_group;
+  np->ondemand = p->ondemand;
+
+  // start at fn(arg) on the new stack.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack;
+  np->trapframe->a0 = arg;
+  np->trapframe->ra = 0;
+
+  np->fdt = p->fdt;
+  acquire(&np->fdt->lock);
+  np->fdt->ref++;
+  release(&np->fdt->lock);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int
 fork(int cow_enabled)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
 
@@ -370,10 +784,7 @@ fork(int cow_enabled)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+  fdtcopy(p, np);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -388,6 +799,8 @@ fork(int cow_enabled)
 
   acquire(&wait_lock);
   np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
   release(&wait_lock);
 
   acquire(&np->lock);
@@ -397,19 +810,182 @@ fork(int cow_enabled)
   return pid;
 }
 
+// Create a new process running the program at path, without
+// copying the caller's memory. The child starts with the caller's
+// open files and current directory, adjusted by the nfa file
+// actions in fa. Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct spawn_fa *fa, int nfa)
+{
+  int i, fd, pid, argc;
+  struct file *f;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // execproc() builds np's page table from the ELF file.
+  uvmunmap(np->pagetable, TRAMPOLINE, 1, 0);
+  uvmunmap(np->pagetable, TRAPFRAME, 1, 0);
+  uvmfree(np->pagetable, 0);
+  np->pagetable = 0;
+
+  np->cow_enabled = false;
+  np->cow_group = np->pid;
+  np->ondemand = p->ondemand;
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+
+  // np is USED, not RUNNABLE, so nothing else touches it
+  // while we sleep in the file system below.
+  release(&np->lock);
+
+  fdtcopy(p, np);
+
+  for(i = 0; i < nfa; i++){
+    fd = fa[i].fd;
+    if(fd < 0 || fd >= NOFILE || np->fdt->ofile[fd] == 0)
+      goto bad;
+    if(fa[i].op == SPAWN_DUP2){
+      if(fa[i].newfd < 0 || fa[i].newfd >= NOFILE)
+        goto bad;
+      if(fa[i].newfd == fd)
+        continue;
+      f = np->fdt->ofile[fa[i].newfd];
+      np->fdt->ofile[fa[i].newfd] = filedup(np->fdt->ofile[fd]);
+      if(f)
+        fileclose(f);
+    } else if(fa[i].op == SPAWN_CLOSE){
+      f = np->fdt->ofile[fd];
+      np->fdt->ofile[fd] = 0;
+      fileclose(f);
+    } else {
+      goto bad;
+    }
+  }
+
+  // argc goes in a0, as exec() returns it.
+  if((argc = execproc(np, path, argv)) < 0)
+    goto bad;
+  np->trapframe->a0 = argc;
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+
+bad:
+  fdtclose(np);
+
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
+}
+
+// A kernel thread's first scheduling switches here.
+static void
+kthreadstart(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
+// Start a kernel thread running fn(), which must not return.
+// It runs only in the kernel, has no parent, and never exits.
+void
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *np;
+
+  if((np = allocproc()) == 0)
+    panic("kthread");
+  np->kfn = fn;
+  np->context.ra = (uint64)kthreadstart;
+  safestrcpy(np->name, name, sizeof(np->name));
+  np->state = RUNNABLE;
+  release(&np->lock);
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
-  struct proc *pp;
+  struct proc *pp, *last;
+
+  if(p->children == 0)
+    return;
+
+  last = 0;
+  for(pp = p->children; pp; pp = pp->sibling){
+    pp->parent = initproc;
+    last = pp;
+  }
+  last->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  wakeup(initproc);
+}
+
+// Threads cannot outlive the process that created them, whose
+// parent expects its wait() to be the end of it: kill every
+// other proc sharing p's address space, wait until they have
+// all exited, and reap the ones that are p's children. Threads
+// created by threads that exited earlier belong to init.
+static void
+killthreads(struct proc *p)
+{
+  struct proc *pp, **link;
+  int i, alive;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
+  acquire(&wait_lock);
+  for(;;){
+    alive = 0;
+    for(i = 0; i < nproc; i++){
+      pp = proc[i];
+      if(pp == p)
+        continue;
+      acquire(&pp->lock);
+      if(pp->vm == p->vm && pp->state != UNUSED && pp->state != ZOMBIE){
+        pp->killed = 1;
+        if(pp->state == SLEEPING)
+          pp->state = RUNNABLE;
+        alive = 1;
+      }
+      release(&pp->lock);
     }
+    if(!alive)
+      break;
+    sleep(p->vm, &wait_lock);  // exit() wakes us
   }
+
+  for(link = &p->children; (pp = *link) != 0; ){
+    acquire(&pp->lock);
+    if(pp->isthread && pp->state == ZOMBIE){
+      *link = pp->sibling;
+      freeproc(pp);
+      release(&pp->lock);
+      continue;
+    }
+    release(&pp->lock);
+    link = &pp->sibling;
+  }
+  release(&wait_lock);
 }
 
 // Exit the current process.  Does not return.
@@ -419,23 +995,22 @@ void
 exit(int status)
 {
   struct proc *p = myproc();
+  int last;
 
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  if(p->vm && !p->isthread)
+    killthreads(p);
+  fdrelease();
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+  // Close all open files, unless other threads still use them.
+  acquire(&p->fdt->lock);
+  last = --p->fdt->ref == 0;
+  release(&p->fdt->lock);
+  if(last)
+    fdtclose(p);
+  p->fdt = 0;
 
   acquire(&wait_lock);
 
@@ -444,6 +1019,10 @@ exit(int status)
 
   // Parent might be sleeping in wait().
   wakeup(p->parent);
+
+  // The creator of our thread group might be in killthreads().
+  if(p->vm)
+    wakeup(p->vm);
   
   acquire(&p->lock);
 
@@ -457,42 +1036,49 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Wait for a child to exit and return its pid.
+// wait() reaps processes; join() reaps threads made by
+// clone(), either thread tid or, if tid is 0, any thread.
+// init reaps orphaned threads along with processes.
+// Return -1 if this process has no such children.
+static int
+waitchild(uint64 addr, int thread, int tid)
 {
-  struct proc *pp;
+  struct proc *pp, **link;
   int havekids, pid;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    for(link = &p->children; (pp = *link) != 0; link = &pp->sibling){
+      if(thread && (!pp->isthread || (tid != 0 && pp->pid != tid)))
+        continue;
+      if(!thread && pp->isthread && p != initproc)
+        continue;
+      havekids = 1;
+
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      if(pp->state == ZOMBIE){
+        // Found one.
+        pid = pp->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        *link = pp->sibling;
+        freeproc(pp);
         release(&pp->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -506,6 +1092,29 @@ wait(uint64 addr)
   }
 }
 
+int
+wait(uint64 addr)
+{
+  return waitchild(addr, 0, 0);
+}
+
+int
+join(int tid)
+{
+  return waitchild(0, 1, tid);
+}
+
+// Does p prefer to run on a CPU other than id, because it
+// ran there last and is still allowed to?
+// p->lock must be held.
+static int
+warmelsewhere(struct proc *p, int id)
+{
+  if(p->lastcpu < 0 || p->lastcpu == id)
+    return 0;
+  return (p->affinity & (1UL << p->lastcpu)) != 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -518,28 +1127,42 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 me = 1UL << id;
+  int ran, steal = 0;
   
   c->proc = 0;
+  __sync_fetch_and_or(&onlinecpus, me);
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
+    ran = 0;
+    for(int i = 0; i < nproc; i++) {
+      p = proc[i];
       acquire(&p->lock);
-      if(p->state == RUNNABLE) {
+      if(p->state == RUNNABLE && (p->affinity & me) &&
+         (steal || !warmelsewhere(p, id))) {
         // Switch to chosen process.  It is the process's job
         // to release its lock and then reacquire it
         // before jumping back to us.
         p->state = RUNNING;
+        p->lastcpu = id;
         c->proc = p;
         swtch(&c->context, &p->context);
 
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         c->proc = 0;
+        ran = 1;
       }
       release(&p->lock);
     }
+
+    // Leave processes to the CPU they last ran on, whose
+    // caches and TLB still hold their state, unless this
+    // CPU found nothing else to do in a whole pass.
+    steal = !ran;
   }
 }
 
@@ -643,7 +1266,8 @@ wakeup(void *chan)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for(int i = 0; i < nproc; i++) {
+    p = proc[i];
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
@@ -662,20 +1286,37 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    p->state = RUNNABLE;
   }
-  return -1;
+  release(&p->lock);
+  return 0;
+}
+
+// Restrict process pid (0 for the caller) to the CPUs in mask.
+// A running process moves off a CPU it may no longer use the
+// next time it gives up the CPU; the caller moves at once.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+
+  if((mask & onlinecpus) == 0)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->affinity = mask;
+  release(&p->lock);
+
+  if(p == myproc())
+    yield();
+  return 0;
 }
 
 void
@@ -745,7 +1386,8 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(int i = 0; i < nproc; i++){
+    p = proc[i];
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -92,6 +92,24 @@ struct heap_tracker_t {
   int    startblock;            // if located in disk, the starting block
 };
 
+/* CSE 536: the heap tracker lives in its own kalloc'd pages so that
+ * struct proc itself fits in one page. HEAPTRACK(p, i) is entry i. */
+#define HEAPTRACK_PER_PAGE  (PGSIZE / sizeof(struct heap_tracker_t))
+#define HEAPTRACK_PAGES     ((MAXHEAP + HEAPTRACK_PER_PAGE - 1) / HEAPTRACK_PER_PAGE)
+#define HEAPTRACK(p, i) \
+  (&(p)->heap_tracker[(i) / HEAPTRACK_PER_PAGE][(i) % HEAPTRACK_PER_PAGE])
+
+// Open files and current directory. Threads made by clone()
+// use their creator's table; every other proc uses its own.
+struct fdtable {
+  struct spinlock lock;        // protects ref, ofile[] and cwd
+  int ref;                     // procs using the table
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
+
+#define NFDHELD 2  // argfd() calls per system call
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -102,23 +120,36 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint64 affinity;             // Mask of CPUs p may run on
+  int lastcpu;                 // CPU p last ran on, or -1
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child, list through sibling
+  struct proc *sibling;        // Next child of the same parent
+
+  struct proc *hashnext;       // pid_lock: next in pid hash chain
+  struct proc *freenext;       // proc_freelock: next free slot
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // User virtual address of trapframe
+  struct vmshare *vm;          // Address space shared with threads, or 0
+  int isthread;                // Created by clone(); reaped by join()
+  void (*kfn)(void);           // Body of a kernel thread, or 0
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct fdtable *fdt;         // &ownfdt, or the creator's if a thread
+  struct fdtable ownfdt;
+  struct file *fdheld[NFDHELD]; // argfd() references, for a shared fdt
+  int nfdheld;
   char name[16];               // Process name (debugging)
 
   /* CSE 536: Variables defined for assignment #2. */
   bool                    ondemand;
-  struct heap_tracker_t   heap_tracker[MAXHEAP];
+  struct heap_tracker_t  *heap_tracker[HEAPTRACK_PAGES];
   int                     resident_heap_pages;
   
   int cow_group;               // The group of processes sharing memory
@@ -9,3 +9,24 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// Log statistics, from logstat().
+struct logstat {
+  uint64 commits;    // transactions committed
+  uint64 blocks;     // blocks written by those commits
+  uint64 forced;     // commits forced by fsync()
+  uint64 checkpoints; // times the log was installed and emptied
+  uint64 installs;   // blocks written home by those checkpoints
+};
+
+// Buffer cache statistics, from bcstat().
+struct bcstat {
+  uint64 hits;       // bread() found the block cached
+  uint64 misses;     // bread() had to allocate a buffer
+  uint64 evictions;  // misses that replaced another cached block
+  uint64 grows;      // pages added to the cache
+  uint64 shrinks;    // pages given back to kalloc()
+  uint64 readaheads; // blocks read ahead of bread()
+  int nbuf;          // buffers in the cache now
+  int freepages;     // pages kalloc() has free
+};
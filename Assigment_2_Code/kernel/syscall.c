@@ -101,6 +101,17 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_bcstat(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_logstat(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_getcpu(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +137,17 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_spawn]   sys_spawn,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_bcstat]  sys_bcstat,
+[SYS_fsync]   sys_fsync,
+[SYS_logstat] sys_logstat,
+[SYS_splice]  sys_splice,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_getcpu]  sys_getcpu,
 };
 
 void
@@ -134,12 +156,16 @@ syscall(void)
   int num;
   struct proc *p = myproc();
   num = p->trapframe->a7;
+
+  // another thread may have grown the shared address space.
+  proc_syncsz(p);
   
   /* Adil: debugging */
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
     p->trapframe->a0 = syscalls[num]();
+    fdrelease();
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
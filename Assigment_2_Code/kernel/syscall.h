@@ -20,3 +20,14 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_clone  22
+#define SYS_join   23
+#define SYS_spawn  24
+#define SYS_setaffinity 25
+#define SYS_bcstat 26
+#define SYS_fsync  27
+#define SYS_logstat 28
+#define SYS_splice 29
+#define SYS_readv  30
+#define SYS_writev 31
+#define SYS_getcpu 32
@@ -18,15 +18,30 @@
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// If other threads share the descriptor table, one of them could
+// close the file while we use it, so take a reference that
+// fdrelease() drops when the system call returns.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct proc *p = myproc();
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&p->fdt->lock);
+  if((f = p->fdt->ofile[fd]) == 0){
+    release(&p->fdt->lock);
     return -1;
+  }
+  if(p->fdt->ref > 1){
+    if(p->nfdheld == NFDHELD)
+      panic("argfd");
+    p->fdheld[p->nfdheld++] = filedup(f);
+  }
+  release(&p->fdt->lock);
   if(pfd)
     *pfd = fd;
   if(pf)
@@ -34,23 +49,51 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
+// Drop the references argfd() took during a system call.
+void
+fdrelease(void)
+{
+  struct proc *p = myproc();
+
+  while(p->nfdheld > 0)
+    fileclose(p->fdheld[--p->nfdheld]);
+}
+
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
 static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct fdtable *fdt = myproc()->fdt;
 
+  acquire(&fdt->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(fdt->ofile[fd] == 0){
+      fdt->ofile[fd] = f;
+      release(&fdt->lock);
       return fd;
     }
   }
+  release(&fdt->lock);
   return -1;
 }
 
+// Clear descriptor fd, if it still refers to f, and
+// return whether it did.
+static int
+fdclear(int fd, struct file *f)
+{
+  struct fdtable *fdt = myproc()->fdt;
+  int r;
+
+  acquire(&fdt->lock);
+  if((r = fdt->ofile[fd] == f))
+    fdt->ofile[fd] = 0;
+  release(&fdt->lock);
+  return r;
+}
+
 uint64
 sys_dup(void)
 {
@@ -76,7 +119,46 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  return fileread(f, 1, p, n);
+}
+
+// Fetch the iovec array of readv()/writev(): argument 1 is
+// its user address, argument 2 its length. Returns the
+// length, or -1. The buffers' lengths must add up to no more
+// than an int, which is what the call returns.
+static int
+argiov(struct iovec *iov)
+{
+  uint64 addr, tot;
+  int i, cnt;
+
+  argaddr(1, &addr);
+  argint(2, &cnt);
+  if(cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, cnt*sizeof(iov[0])) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if(iov[i].len < 0)
+      return -1;
+    tot += iov[i].len;
+  }
+  if(tot > 0x7fffffff)
+    return -1;
+  return cnt;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(iov)) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
 }
 
 uint64
@@ -91,7 +173,19 @@ sys_write(void)
   if(argfd(0, 0, &f) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  return filewrite(f, 1, p, n);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(iov)) < 0)
+    return -1;
+  return filewritev(f, 1, iov, cnt);
 }
 
 uint64
@@ -102,7 +196,9 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  // another thread may have closed it already.
+  if(!fdclear(fd, f))
+    return -1;
   fileclose(f);
   return 0;
 }
@@ -119,6 +215,60 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Copy buffer cache statistics to user struct bcstat.
+uint64
+sys_bcstat(void)
+{
+  struct bcstat st;
+  uint64 addr; // user pointer to struct bcstat
+
+  argaddr(0, &addr);
+  bstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Move up to n bytes from fd_in to fd_out inside the kernel.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// Make all finished writes durable. The log is shared by all
+// files, so this commits everything, not just fd's blocks.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_force();
+  return 0;
+}
+
+// Copy log statistics to user struct logstat.
+uint64
+sys_logstat(void)
+{
+  struct logstat st;
+  uint64 addr; // user pointer to struct logstat
+
+  argaddr(0, &addr);
+  logstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -129,16 +279,16 @@ sys_link(void)
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_opn(DIROPBLOCKS);
   if((ip = namei(old)) == 0){
-    end_op();
+    end_opn(DIROPBLOCKS);
     return -1;
   }
 
   ilock(ip);
   if(ip->type == T_DIR){
     iunlockput(ip);
-    end_op();
+    end_opn(DIROPBLOCKS);
     return -1;
   }
 
@@ -156,7 +306,7 @@ sys_link(void)
   iunlockput(dp);
   iput(ip);
 
-  end_op();
+  end_opn(DIROPBLOCKS);
 
   return 0;
 
@@ -165,31 +315,14 @@ bad:
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
-  end_op();
+  end_opn(DIROPBLOCKS);
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -214,14 +347,12 @@ sys_unlink(void)
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !isdirempty(ip)){
+  if(ip->type == T_DIR && !dirempty(ip)){
     iunlockput(ip);
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -308,36 +439,37 @@ sys_open(void)
   int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
+  int n, nop;
 
   argint(1, &omode);
   if((n = argstr(0, path, MAXPATH)) < 0)
     return -1;
 
-  begin_op();
+  nop = (omode & O_CREATE) ? DIROPBLOCKS : MAXOPBLOCKS;
+  begin_opn(nop);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
-      end_op();
+      end_opn(nop);
       return -1;
     }
   } else {
     if((ip = namei(path)) == 0){
-      end_op();
+      end_opn(nop);
       return -1;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
-      end_op();
+      end_opn(nop);
       return -1;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
-    end_op();
+    end_opn(nop);
     return -1;
   }
 
@@ -345,7 +477,7 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
-    end_op();
+    end_opn(nop);
     return -1;
   }
 
@@ -365,7 +497,7 @@ sys_open(void)
   }
 
   iunlock(ip);
-  end_op();
+  end_opn(nop);
 
   return fd;
 }
@@ -376,13 +508,13 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
+  begin_opn(DIROPBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
-    end_op();
+    end_opn(DIROPBLOCKS);
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  end_opn(DIROPBLOCKS);
   return 0;
 }
 
@@ -393,16 +525,16 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
+  begin_opn(DIROPBLOCKS);
   argint(1, &major);
   argint(2, &minor);
   if((argstr(0, path, MAXPATH)) < 0 ||
      (ip = create(path, T_DEVICE, major, minor)) == 0){
-    end_op();
+    end_opn(DIROPBLOCKS);
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  end_opn(DIROPBLOCKS);
   return 0;
 }
 
@@ -410,8 +542,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct fdtable *fdt = myproc()->fdt;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -425,30 +557,31 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  acquire(&fdt->lock);
+  old = fdt->cwd;
+  fdt->cwd = ip;
+  release(&fdt->lock);
+  iput(old);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Copy the user argv array at uargv into kernel pages.
+// On failure argv holds what was copied so far, which
+// the caller must free with freeargv().
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -456,22 +589,71 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
+static void
+freeargv(char **argv)
+{
+  int i;
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0){
+    freeargv(argv);
+    return -1;
+  }
+
+  int ret = exec(path, argv);
+
+  freeargv(argv);
 
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  struct spawn_fa fa[SPAWN_MAXFA];
+  uint64 uargv, ufa;
+  int nfa;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufa);
+  argint(3, &nfa);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if(nfa < 0 || nfa > SPAWN_MAXFA)
+    return -1;
+  if(nfa > 0 && copyin(myproc()->pagetable, (char*)fa, ufa, nfa*sizeof(fa[0])) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0){
+    freeargv(argv);
+    return -1;
+  }
+
+  int ret = spawn(path, argv, fa, nfa);
+
+  freeargv(argv);
+
+  return ret;
 }
 
 uint64
@@ -488,15 +670,15 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdclear(fd0, rf);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdclear(fd0, rf);
+    fdclear(fd1, wf);
     fileclose(rf);
     fileclose(wf);
     return -1;
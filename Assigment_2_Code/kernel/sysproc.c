@@ -29,6 +29,26 @@ sys_fork(void)
   return fork(cow_enabled);
 }
 
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+
+  argint(0, &tid);
+  return join(tid);
+}
+
 uint64
 sys_wait(void)
 {
@@ -80,6 +100,29 @@ sys_kill(void)
   return kill(pid);
 }
 
+// pin process pid (0 for self) to the CPUs in a bit mask.
+uint64
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  argint(0, &pid);
+  argint(1, &mask);
+  return setaffinity(pid, (uint)mask);
+}
+
+// return the CPU the caller is running on.
+uint64
+sys_getcpu(void)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  pop_off();
+  return id;
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
@@ -55,7 +55,9 @@ usertrap(void)
   uint64 scause = r_scause();
   //printf("Inside usertrap scause: %x and sepc: %x\n", scause, p->trapframe->epc);
   if(scause == 12 || scause == 13 || scause == 15){
+    proc_lockvm(p);
     page_fault_handler();
+    proc_unlockvm(p);
   } else if(scause == 8){
     // system call
 
@@ -132,7 +134,7 @@ usertrapret(void)
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, p->tfva);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
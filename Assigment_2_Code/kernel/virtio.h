@@ -47,7 +47,12 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+// a request uses one for its header, one per block and one
+// for its status.
+#define NUM 64
+
+// most blocks in one request.
+#define MAXSEG 16
 
 // a single descriptor, from the spec.
 struct virtq_desc {
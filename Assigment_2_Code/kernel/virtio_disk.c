@@ -46,8 +46,9 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b; // first buf; the rest follow b->qnext
     char status;
+    void (*done)(struct buf*); // called when the request completes
   } info[NUM];
 
   // disk command headers.
@@ -196,12 +197,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +212,28 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Post one request transferring the n (<= MAXSEG) bufs in bs,
+// which hold consecutive blocks, to or from the disk.
+static void
+virtio_post(struct buf **bs, int n, int write, void (*done)(struct buf*))
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = bs[0]->blockno * (BSIZE / 512);
+  int i;
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, descriptors for the
+  // data, and one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
+  int idx[MAXSEG+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n+2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,24 +250,30 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(i = 1; i <= n; i++){
+    disk.desc[idx[i]].addr = (uint64) bs[i-1]->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
+
+  // record the bufs for virtio_disk_intr().
+  for(i = 0; i < n; i++){
+    bs[i]->disk = 1;
+    bs[i]->qnext = i+1 < n ? bs[i+1] : 0;
+  }
+  disk.info[idx[0]].b = bs[0];
+  disk.info[idx[0]].done = done;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -279,16 +286,95 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// Return the end of the run of bufs starting at bs[i], of
+// consecutive blocks on one device, that fits in a request.
+static int
+runend(struct buf **bs, int i, int n)
+{
+  int j;
+
+  for(j = i+1; j < n && j-i < MAXSEG; j++)
+    if(bs[j]->dev != bs[i]->dev || bs[j]->blockno != bs[j-1]->blockno + 1)
+      break;
+  return j;
+}
+
+// Start transfers of the n bufs in bs to (write) or from the
+// disk, and return without waiting for them. Runs of bufs
+// with consecutive block numbers go to the device as single
+// requests. Many requests, from any number of processes,
+// may be in flight at once.
+// When the disk is done with a buf b, virtio_disk_intr() clears
+// b->disk, wakes up virtio_disk_wait(b), and calls done(b) if
+// done isn't 0. done() runs in interrupt context and must not
+// sleep. Sleeps if all descriptors are in use.
+void
+virtio_submitv(struct buf **bs, int n, int write, void (*done)(struct buf*))
+{
+  int i, j;
+
+  acquire(&disk.vdisk_lock);
+  for(i = 0; i < n; i = j){
+    j = runend(bs, i, n);
+    virtio_post(bs+i, j-i, write, done);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// Like virtio_submitv(), but if there aren't enough free
+// descriptors for all of bs, start nothing and return -1
+// rather than sleep. Returns 0 if the transfers were started.
+int
+virtio_trysubmitv(struct buf **bs, int n, int write, void (*done)(struct buf*))
+{
+  int i, j, need, nfree;
 
+  acquire(&disk.vdisk_lock);
+  need = nfree = 0;
+  for(i = 0; i < n; i = j){
+    j = runend(bs, i, n);
+    need += j-i + 2;
+  }
+  for(i = 0; i < NUM; i++)
+    nfree += disk.free[i];
+  if(nfree < need){
+    release(&disk.vdisk_lock);
+    return -1;
+  }
+  for(i = 0; i < n; i = j){
+    j = runend(bs, i, n);
+    virtio_post(bs+i, j-i, write, done);
+  }
   release(&disk.vdisk_lock);
+  return 0;
+}
+
+// Start a transfer of b; see virtio_submitv().
+void
+virtio_submit(struct buf *b, int write, void (*done)(struct buf*))
+{
+  virtio_submitv(&b, 1, write, done);
+}
+
+// Wait for the transfer of b started by virtio_submit()
+// to finish. Returns at once if none is in flight.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  while(b->disk == 1) {
+    sleep(b, &disk.vdisk_lock);
+  }
+  release(&disk.vdisk_lock);
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_submit(b, write, 0);
+  virtio_disk_wait(b);
 }
 
 void
@@ -316,11 +402,29 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
-
+    struct buf *b, *bs[MAXSEG];
+    void (*done)(struct buf*) = disk.info[id].done;
+    int i, n = 0;
+    for(b = disk.info[id].b; b; b = b->qnext)
+      bs[n++] = b;
+    disk.info[id].b = 0;
+    disk.info[id].done = 0;
+    free_chain(id);
     disk.used_idx += 1;
+
+    for(i = 0; i < n; i++){
+      bs[i]->qnext = 0;
+      bs[i]->disk = 0;   // disk is done with buf
+      wakeup(bs[i]);
+    }
+
+    if(done){
+      // done() may start more I/O.
+      release(&disk.vdisk_lock);
+      for(i = 0; i < n; i++)
+        done(bs[i]);
+      acquire(&disk.vdisk_lock);
+    }
   }
 
   release(&disk.vdisk_lock);
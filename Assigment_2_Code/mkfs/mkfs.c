@@ -15,14 +15,16 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 4096  // enough for directories of thousands of files
+#define NROOT 400    // most entries in the root directory
+#define DPB (BSIZE / sizeof(struct dirent))
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE;   // mkfs -l nlog
 int nswap = PSASIZE; // CSE 536: Allocating blocks in fs.img for the PSA
 int nmeta;           // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;         // Number of data blocks
@@ -32,6 +34,8 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+struct dirent rootde[NROOT];
+int nroot;
 
 
 void balloc(int);
@@ -42,6 +46,8 @@ void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
 void die(const char *);
+void rootent(uint inum, char *name);
+void wdir(uint inum, struct dirent *de, int n);
 
 // convert to riscv byte order
 ushort
@@ -70,21 +76,34 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+    // the kernel needs room for three FS system calls
+    // besides the header, and holds the header in memory.
+    if(nlog < 3*MAXOPBLOCKS + 1 || nlog > MAXLOGSIZE){
+      fprintf(stderr, "mkfs: log size must be %d..%d blocks\n",
+              3*MAXOPBLOCKS + 1, MAXLOGSIZE);
+      exit(1);
+    }
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] fs.img files...\n");
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(sizeof(struct dirhead) == sizeof(struct dirent));
+  assert(sizeof(struct dirindex) == sizeof(struct dirent));
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
@@ -123,15 +142,8 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  rootent(rootino, ".");
+  rootent(rootino, "..");
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -155,10 +167,7 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rootent(inum, shortname);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -166,12 +175,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  wdir(rootino, rootde, nroot);
 
   balloc(freeblock);
 
@@ -255,6 +259,61 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block holding block fbn of the file, which
+// is at most one past its end, allocating it if need be. The
+// new block extends the last extent if it follows it on disk.
+// Extent blocks are written back as soon as they change.
+uint
+xbmap(struct dinode *din, uint fbn)
+{
+  struct extblock eb;
+  struct extent *ext, *e;
+  uint i, n, bn, cur, *next;
+
+  ext = din->ext;
+  n = NEXTENT;
+  next = &din->indirect;
+  cur = 0;    // extent block in eb, 0 for the inode
+  bn = 0;
+  e = 0;
+  for(;;){
+    for(i = 0; i < n && xint(ext[i].len) != 0; i++){
+      e = &ext[i];
+      if(fbn < bn + xint(e->len))
+        return xint(e->start) + fbn - bn;
+      bn += xint(e->len);
+    }
+    if(i < n || xint(*next) == 0)
+      break;
+    cur = xint(*next);
+    rsect(cur, (char*)&eb);
+    ext = eb.ext;
+    n = NIEXTENT;
+    next = &eb.next;
+  }
+  assert(fbn == bn);
+  // e is the last extent, in block cur unless i is 0.
+  if(e && xint(e->start) + xint(e->len) == freeblock){
+    e->len = xint(xint(e->len) + 1);
+  } else {
+    if(i == n){
+      // chain a new extent block.
+      *next = xint(freeblock++);
+      if(cur)
+        wsect(cur, (char*)&eb);
+      cur = xint(*next);
+      memset(&eb, 0, sizeof(eb));
+      ext = eb.ext;
+      i = 0;
+    }
+    ext[i].start = xint(freeblock);
+    ext[i].len = xint(1);
+  }
+  if(cur)
+    wsect(cur, (char*)&eb);
+  return freeblock++;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -262,7 +321,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -271,22 +329,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = xbmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -299,6 +342,96 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+void
+rootent(uint inum, char *name)
+{
+  struct dirent *de;
+
+  if(nroot >= NROOT){
+    fprintf(stderr, "mkfs: too many files\n");
+    exit(1);
+  }
+  de = &rootde[nroot++];
+  bzero(de, sizeof(*de));
+  de->inum = xshort(inum);
+  strncpy(de->name, name, DIRSIZ);
+}
+
+// Same as the kernel's dirhash().
+uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Write the directory inum with the n entries de[], the first
+// two being "." and "..": in one block if they fit, else in the
+// hashed format described in kernel/fs.c, with the fewest
+// buckets that hold them all.
+void
+wdir(uint inum, struct dirent *de, int n)
+{
+  char blk[BSIZE];
+  struct dirent *bde = (struct dirent*)blk;
+  struct dirhead *h;
+  struct dirindex *idx;
+  int depth, nb, i, j, k, cnt[1 << DIRMAXDEPTH];
+
+  if(n <= DPB){
+    bzero(blk, BSIZE);
+    memmove(blk, de, n * sizeof(*de));
+    iappend(inum, blk, BSIZE);
+    return;
+  }
+
+  for(depth = 1; ; depth++){
+    if(depth > DIRMAXDEPTH){
+      fprintf(stderr, "mkfs: too many files\n");
+      exit(1);
+    }
+    nb = 1 << depth;
+    bzero(cnt, sizeof(cnt));
+    for(i = 2; i < n; i++)
+      cnt[dirhash(de[i].name) & (nb-1)]++;
+    for(j = 0; j < nb && cnt[j] < DPB; j++)
+      ;
+    if(j == nb)
+      break;
+  }
+
+  bzero(blk, BSIZE);
+  bde[0] = de[0];
+  bde[1] = de[1];
+  h = (struct dirhead*)blk + 2;
+  h->magic = xshort(DIRMAGIC);
+  h->depth = xshort(depth);
+  h->nent = xshort(n - 2);
+  iappend(inum, blk, BSIZE);
+
+  bzero(blk, BSIZE);
+  idx = (struct dirindex*)blk;
+  for(j = 0; j < nb; j++)
+    idx[j / DIRIPE].bucket[j % DIRIPE] = xshort(2 + j);
+  iappend(inum, blk, BSIZE);
+
+  for(j = 0; j < nb; j++){
+    bzero(blk, BSIZE);
+    h = (struct dirhead*)blk;
+    h->magic = xshort(DIRMAGIC);
+    h->depth = xshort(depth);
+    k = 1;
+    for(i = 2; i < n; i++)
+      if((dirhash(de[i].name) & (nb-1)) == j)
+        bde[k++] = de[i];
+    iappend(inum, blk, BSIZE);
+  }
+}
+
 void
 die(const char *s)
 {
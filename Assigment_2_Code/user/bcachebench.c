@@ -0,0 +1,104 @@
+// Buffer cache scaling benchmark: 1, 2 and 4 processes each
+// read their own small, fully cached file over and over, so
+// the time goes into bread()/brelse() rather than the disk.
+// With the cache split into hash buckets the total time should
+// stay roughly flat as processes are added (run with CPUS > 1).
+//
+// usage: bcachebench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define MAXPROCS 4
+#define NBLOCKS 4   // per file; all files must fit in the cache
+
+char buf[BSIZE];
+
+void
+mkfile(char *name)
+{
+  int fd, i;
+
+  if((fd = open(name, O_CREATE|O_WRONLY|O_TRUNC)) < 0){
+    printf("bcachebench: cannot create %s\n", name);
+    exit(1);
+  }
+  memset(buf, 'b', sizeof(buf));
+  for(i = 0; i < NBLOCKS; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("bcachebench: write %s failed\n", name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+void
+reader(char *name, int rounds)
+{
+  int fd, i;
+
+  for(i = 0; i < rounds; i++){
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("bcachebench: open %s failed\n", name);
+      exit(1);
+    }
+    while(read(fd, buf, sizeof(buf)) == sizeof(buf))
+      ;
+    close(fd);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, t, rounds = 500;
+  char name[] = "bcb0";
+  struct bcstat st0, st;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds <= 0){
+    printf("usage: bcachebench [rounds]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < MAXPROCS; i++){
+    name[3] = '0' + i;
+    mkfile(name);
+  }
+
+  for(n = 1; n <= MAXPROCS; n *= 2){
+    bcstat(&st0);
+    t = uptime();
+    for(i = 0; i < n; i++){
+      int pid = fork(0);
+      if(pid < 0){
+        printf("bcachebench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        name[3] = '0' + i;
+        reader(name, rounds);
+      }
+    }
+    for(i = 0; i < n; i++)
+      wait(0);
+    t = uptime() - t;
+    bcstat(&st);
+    printf("%d procs: %d block reads in %d ticks, %d hits %d misses %d evictions, %d buffers\n",
+           n, n * rounds * NBLOCKS, t, (int)(st.hits - st0.hits),
+           (int)(st.misses - st0.misses), (int)(st.evictions - st0.evictions),
+           st.nbuf);
+  }
+
+  for(i = 0; i < MAXPROCS; i++){
+    name[3] = '0' + i;
+    unlink(name);
+  }
+  exit(0);
+}
@@ -9,6 +9,10 @@ cat(int fd)
 {
   int n;
 
+  // let the kernel move the bytes without copying them
+  // through buf; read() and write() report any error.
+  while((n = splice(fd, 1, 8192)) > 0)
+    ;
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
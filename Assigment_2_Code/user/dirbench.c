@@ -0,0 +1,90 @@
+// Large directory benchmark: create n files in one directory,
+// open each by name, then unlink them all. Creating a file first
+// checks that its name is free and unlink must find the entry's
+// offset, so both miss the name cache and search the directory;
+// once the directory is hashed each search reads one bucket
+// instead of every block before the name.
+//
+// usage: dirbench [nfiles]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+
+char *dir = "db";
+
+void
+mkname(char *path, int i)
+{
+  strcpy(path, dir);
+  path[2] = '/';
+  path[3] = 'f';
+  path[4] = '0' + i / 1000;
+  path[5] = '0' + i / 100 % 10;
+  path[6] = '0' + i / 10 % 10;
+  path[7] = '0' + i % 10;
+  path[8] = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, t, n = 2000;
+  char path[9];
+  struct stat st;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0 || n > 9999){
+    printf("usage: dirbench [nfiles]\n");
+    exit(1);
+  }
+
+  if(mkdir(dir) < 0){
+    printf("dirbench: mkdir %s failed\n", dir);
+    exit(1);
+  }
+
+  t = uptime();
+  for(i = 0; i < n; i++){
+    mkname(path, i);
+    if((fd = open(path, O_CREATE|O_WRONLY)) < 0){
+      printf("dirbench: cannot create %s\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+  t = uptime() - t;
+  stat(dir, &st);
+  printf("%d creates in %d ticks, directory is %d bytes\n", n, t, (int)st.size);
+
+  t = uptime();
+  for(i = 0; i < n; i++){
+    mkname(path, i);
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf("dirbench: open %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+  t = uptime() - t;
+  printf("%d opens in %d ticks\n", n, t);
+
+  t = uptime();
+  for(i = 0; i < n; i++){
+    mkname(path, i);
+    if(unlink(path) < 0){
+      printf("dirbench: unlink %s failed\n", path);
+      exit(1);
+    }
+  }
+  t = uptime() - t;
+  printf("%d unlinks in %d ticks\n", n, t);
+
+  if(unlink(dir) < 0){
+    printf("dirbench: unlink %s failed\n", dir);
+    exit(1);
+  }
+  exit(0);
+}
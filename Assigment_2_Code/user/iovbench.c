@@ -0,0 +1,75 @@
+// writev() benchmark: append n records, each a header, a body
+// and a trailer in separate buffers, to a file, first with one
+// write() per piece, then with one writev() per record, which
+// takes one system call and one FS system call per record.
+//
+// usage: iovbench [nrecords]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+
+char *file = "iovbench.tmp";
+char head[] = "record: ";
+char body[] = "the quick brown fox jumps over the lazy dog";
+char tail[] = "\n";
+
+void
+run(char *name, int vectored, int n)
+{
+  struct iovec iov[3];
+  struct logstat st0, st;
+  int fd, i, t;
+
+  if((fd = open(file, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("iovbench: cannot create %s\n", file);
+    exit(1);
+  }
+  iov[0].base = head;
+  iov[0].len = strlen(head);
+  iov[1].base = body;
+  iov[1].len = strlen(body);
+  iov[2].base = tail;
+  iov[2].len = strlen(tail);
+
+  logstat(&st0);
+  t = uptime();
+  for(i = 0; i < n; i++){
+    if(vectored){
+      if(writev(fd, iov, 3) < 0)
+        break;
+    } else if(write(fd, head, iov[0].len) < 0 ||
+              write(fd, body, iov[1].len) < 0 ||
+              write(fd, tail, iov[2].len) < 0){
+      break;
+    }
+  }
+  t = uptime() - t;
+  logstat(&st);
+  close(fd);
+  if(i < n){
+    printf("iovbench: %s failed\n", name);
+    exit(1);
+  }
+  printf("%s: %d records in %d ticks, %d commits\n",
+         name, n, t, (int)(st.commits - st0.commits));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 2000;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0 || n > 50000){
+    printf("usage: iovbench [nrecords]\n");
+    exit(1);
+  }
+
+  run("write", 0, n);
+  run("writev", 1, n);
+  unlink(file);
+  exit(0);
+}
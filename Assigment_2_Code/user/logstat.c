@@ -0,0 +1,26 @@
+// Print write-ahead log statistics.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(void)
+{
+  struct logstat st;
+
+  if(logstat(&st) < 0){
+    fprintf(2, "logstat: failed\n");
+    exit(1);
+  }
+  printf("commits %d (%d forced by fsync), blocks %d",
+         (int)st.commits, (int)st.forced, (int)st.blocks);
+  if(st.commits > 0)
+    printf(", %d.%d blocks/commit",
+           (int)(st.blocks / st.commits),
+           (int)(st.blocks * 10 / st.commits % 10));
+  printf("\n");
+  printf("checkpoints %d, blocks installed %d\n",
+         (int)st.checkpoints, (int)st.installs);
+  exit(0);
+}
@@ -0,0 +1,114 @@
+// Path lookup benchmark: open a file five directories deep,
+// and look up a name that doesn't exist there, over and over.
+// Both go through namex() one component at a time; with the
+// directory name cache the second and later lookups of each
+// component skip the directory scan, including the failing
+// one, which is a negative entry.
+//
+// usage: lookupbench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+
+#define NDIRS 5
+
+char *dirs[NDIRS] = { "lb", "lb/a", "lb/a/b", "lb/a/b/c", "lb/a/b/c/d" };
+char *file = "lb/a/b/c/d/f";
+char *missing = "lb/a/b/c/d/nosuchfile";
+
+// Fill a directory with entries, so a scan has work to do.
+void
+populate(char *dir, int n)
+{
+  char path[32];
+  int i, fd, len;
+
+  strcpy(path, dir);
+  len = strlen(path);
+  path[len] = '/';
+  for(i = 0; i < n; i++){
+    path[len+1] = 'x';
+    path[len+2] = '0' + i / 10;
+    path[len+3] = '0' + i % 10;
+    path[len+4] = 0;
+    if((fd = open(path, O_CREATE|O_WRONLY)) < 0){
+      printf("lookupbench: cannot create %s\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+}
+
+void
+unpopulate(char *dir, int n)
+{
+  char path[32];
+  int i, len;
+
+  strcpy(path, dir);
+  len = strlen(path);
+  path[len] = '/';
+  for(i = 0; i < n; i++){
+    path[len+1] = 'x';
+    path[len+2] = '0' + i / 10;
+    path[len+3] = '0' + i % 10;
+    path[len+4] = 0;
+    unlink(path);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, t, rounds = 2000;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds <= 0){
+    printf("usage: lookupbench [rounds]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < NDIRS; i++){
+    if(mkdir(dirs[i]) < 0){
+      printf("lookupbench: mkdir %s failed\n", dirs[i]);
+      exit(1);
+    }
+    populate(dirs[i], 40);
+  }
+  if((fd = open(file, O_CREATE|O_WRONLY)) < 0){
+    printf("lookupbench: cannot create %s\n", file);
+    exit(1);
+  }
+  close(fd);
+
+  t = uptime();
+  for(i = 0; i < rounds; i++){
+    if((fd = open(file, O_RDONLY)) < 0){
+      printf("lookupbench: open %s failed\n", file);
+      exit(1);
+    }
+    close(fd);
+  }
+  t = uptime() - t;
+  printf("%d opens of %s in %d ticks\n", rounds, file, t);
+
+  t = uptime();
+  for(i = 0; i < rounds; i++){
+    if(open(missing, O_RDONLY) >= 0){
+      printf("lookupbench: %s exists\n", missing);
+      exit(1);
+    }
+  }
+  t = uptime() - t;
+  printf("%d failed opens of %s in %d ticks\n", rounds, missing, t);
+
+  unlink(file);
+  for(i = NDIRS - 1; i >= 0; i--){
+    unpopulate(dirs[i], 40);
+    unlink(dirs[i]);
+  }
+  exit(0);
+}
@@ -0,0 +1,75 @@
+// Pipe throughput benchmark: a child writes nkb kilobytes into
+// a pipe in chunks of each size below, and the parent reads
+// them out in the same size. With the ring copied a span at a
+// time rather than a byte at a time, large chunks should move
+// at close to memory speed.
+//
+// usage: pipebench [nkb]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int sizes[] = { 64, 512, 4096, 8192 };
+
+char buf[8192];
+
+void
+run(int chunk, int nkb)
+{
+  int p[2], pid, n, t, total, want;
+
+  want = nkb * 1024;
+  if(pipe(p) < 0){
+    printf("pipebench: pipe failed\n");
+    exit(1);
+  }
+  t = uptime();
+  pid = fork(0);
+  if(pid < 0){
+    printf("pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    for(total = 0; total < want; total += chunk){
+      if(write(p[1], buf, chunk) != chunk){
+        printf("pipebench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(p[1]);
+  total = 0;
+  while((n = read(p[0], buf, chunk)) > 0)
+    total += n;
+  close(p[0]);
+  wait(0);
+  t = uptime() - t;
+  if(total != want){
+    printf("pipebench: read %d bytes, want %d\n", total, want);
+    exit(1);
+  }
+  if(t == 0)
+    t = 1;
+  // uptime() ticks are roughly 1/10th of a second.
+  printf("%d-byte chunks: %d KB in %d ticks, %d KB/sec\n",
+         chunk, nkb, t, nkb * 10 / t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, nkb = 4096;
+
+  if(argc > 1)
+    nkb = atoi(argv[1]);
+  if(nkb <= 0){
+    printf("usage: pipebench [nkb]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+    run(sizes[i], nkb);
+  exit(0);
+}
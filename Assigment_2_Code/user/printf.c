@@ -6,10 +6,120 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// Output is buffered per file descriptor, so that a printf()
+// costs one write() instead of one per character. Output to
+// the console (a device) and to fd 2 goes out at the end of
+// each call, so a prompt without a newline still shows up.
+// Output to files and pipes stays in the buffer until it
+// fills, fflush() is called, or the fd is closed; fork(),
+// exec(), spawn() and exit() flush everything first (see
+// usys.pl).
+//
+// Threads share the buffers, so each has a spinlock, held for
+// a whole printf() call; one call's output is not interleaved
+// with another's.
+
+#define NSTREAM 16     // fds with a buffer; higher ones write through
+#define STREAMBUF 512
+
+#define S_UNKNOWN 0    // not yet looked at
+#define S_CALL    1    // flush at the end of each call
+#define S_FULL    2    // flush when full
+
+struct stream {
+  uint locked;   // a thread is printing or flushing
+  int mode;
+  int n;
+  char buf[STREAMBUF];
+};
+
+static struct stream streams[NSTREAM];
+
+// The raw system call stubs in usys.S.
+int _fork(int);
+int _exit(int) __attribute__((noreturn));
+int _close(int);
+int _exec(const char*, char**);
+int _spawn(const char*, char**, struct spawn_fa*, int);
+
+static void
+slock(struct stream *s)
+{
+  while(__sync_lock_test_and_set(&s->locked, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+static void
+sunlock(struct stream *s)
+{
+  __sync_synchronize();
+  __sync_lock_release(&s->locked);
+}
+
+// Write out fd's buffered output. Caller holds its lock.
+static int
+sflush(int fd)
+{
+  struct stream *s = &streams[fd];
+  int n;
+
+  n = s->n;
+  s->n = 0;
+  if(n > 0 && write(fd, s->buf, n) != n)
+    return -1;
+  return 0;
+}
+
+// Write out fd's buffered output, or every fd's if fd < 0.
+int
+fflush(int fd)
+{
+  int r;
+
+  if(fd < 0){
+    r = 0;
+    for(fd = 0; fd < NSTREAM; fd++)
+      if(fflush(fd) < 0)
+        r = -1;
+    return r;
+  }
+  if(fd >= NSTREAM)
+    return 0;
+  slock(&streams[fd]);
+  r = sflush(fd);
+  sunlock(&streams[fd]);
+  return r;
+}
+
+// Decide how to buffer fd the first time it is printed to.
+// Caller holds its lock.
+static void
+setmode(int fd)
+{
+  struct stat st;
+
+  if(streams[fd].mode != S_UNKNOWN)
+    return;
+  if(fd == 2)
+    streams[fd].mode = S_CALL;
+  else if(fstat(fd, &st) == 0)
+    streams[fd].mode = st.type == T_DEVICE ? S_CALL : S_FULL;
+}
+
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  struct stream *s;
+
+  if(fd < 0 || fd >= NSTREAM){
+    write(fd, &c, 1);
+    return;
+  }
+  s = &streams[fd];
+  if(s->n == STREAMBUF)
+    sflush(fd);
+  s->buf[s->n++] = c;
 }
 
 static void
@@ -54,6 +164,10 @@ vprintf(int fd, const char *fmt, va_list ap)
   char *s;
   int c, i, state;
 
+  if(fd >= 0 && fd < NSTREAM){
+    slock(&streams[fd]);
+    setmode(fd);
+  }
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -92,6 +206,11 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+  if(fd >= 0 && fd < NSTREAM){
+    if(streams[fd].mode != S_FULL)
+      sflush(fd);
+    sunlock(&streams[fd]);
+  }
 }
 
 void
@@ -111,3 +230,55 @@ printf(const char *fmt, ...)
   va_start(ap, fmt);
   vprintf(1, fmt, ap);
 }
+
+// Hold every lock across the fork, so that the child does not
+// start with one that another thread held.
+int
+fork(int cow)
+{
+  int fd, pid;
+
+  for(fd = 0; fd < NSTREAM; fd++){
+    slock(&streams[fd]);
+    sflush(fd);
+  }
+  pid = _fork(cow);
+  for(fd = 0; fd < NSTREAM; fd++)
+    sunlock(&streams[fd]);
+  return pid;
+}
+
+int
+exec(const char *path, char **argv)
+{
+  fflush(-1);
+  return _exec(path, argv);
+}
+
+int
+spawn(const char *path, char **argv, struct spawn_fa *fa, int nfa)
+{
+  fflush(-1);
+  return _spawn(path, argv, fa, nfa);
+}
+
+int
+exit(int status)
+{
+  fflush(-1);
+  _exit(status);
+}
+
+// The fd may be reused for a different file, so forget
+// how it was buffered.
+int
+close(int fd)
+{
+  if(fd >= 0 && fd < NSTREAM){
+    slock(&streams[fd]);
+    sflush(fd);
+    streams[fd].mode = S_UNKNOWN;
+    sunlock(&streams[fd]);
+  }
+  return _close(fd);
+}
@@ -52,6 +52,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
 // Execute cmd.  Never returns.
@@ -131,6 +132,98 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Return the number of spawn() file actions spawncmd() needs
+// to run cmd, or -1 if cmd needs a forked copy of the shell.
+int
+spawnfa(struct cmd *cmd)
+{
+  int l, r;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    return 0;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((l = spawnfa(rcmd->cmd)) < 0)
+      return -1;
+    return l + 2;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if((l = spawnfa(pcmd->left)) < 0 || (r = spawnfa(pcmd->right)) < 0)
+      return -1;
+    return 3 + (l > r ? l : r);
+  }
+  return -1;
+}
+
+// Run a pipeline of (possibly redirected) commands from the
+// shell itself: each program is spawn()ed with the nfa file
+// actions in fa, instead of exec()ing in a forked shell.
+// Returns the number of children started.
+int
+spawncmd(struct cmd *cmd, struct spawn_fa *fa, int nfa)
+{
+  int p[2], fd, n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  default:
+    panic("spawncmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, fa, nfa) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    fa[nfa].op = SPAWN_DUP2;
+    fa[nfa].fd = fd;
+    fa[nfa].newfd = rcmd->fd;
+    fa[nfa+1].op = SPAWN_CLOSE;
+    fa[nfa+1].fd = fd;
+    n = spawncmd(rcmd->cmd, fa, nfa+2);
+    close(fd);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      return 0;
+    }
+    fa[nfa].op = SPAWN_DUP2;
+    fa[nfa].fd = p[1];
+    fa[nfa].newfd = 1;
+    fa[nfa+1].op = SPAWN_CLOSE;
+    fa[nfa+1].fd = p[0];
+    fa[nfa+2].op = SPAWN_CLOSE;
+    fa[nfa+2].fd = p[1];
+    n = spawncmd(pcmd->left, fa, nfa+3);
+    fa[nfa].fd = p[0];
+    fa[nfa].newfd = 0;
+    n += spawncmd(pcmd->right, fa, nfa+3);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -146,7 +239,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  struct spawn_fa fa[SPAWN_MAXFA];
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -165,9 +260,21 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    // Pipelines are spawned directly; anything else
+    // runs in a forked copy of the shell.
+    n = spawnfa(cmd);
+    if(n >= 0 && n <= SPAWN_MAXFA)
+      n = spawncmd(cmd, fa, 0);
+    else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      n = 1;
+    }
+    while(n-- > 0)
+      wait(0);
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -262,6 +369,17 @@ backcmd(struct cmd *subcmd)
 
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
+int parseerr;
+
+// The shell parses commands itself, so a syntax error
+// must not exit; parsecmd() returns 0 instead.
+void
+syntax(char *s)
+{
+  if(!parseerr)
+    fprintf(2, "%s\n", s);
+  parseerr = 1;
+}
 
 int
 gettoken(char **ps, char *es, char **q, char **eq)
@@ -331,12 +449,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -380,8 +503,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -406,8 +531,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -432,13 +559,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -446,6 +577,43 @@ parseexec(char **ps, char *es)
   return ret;
 }
 
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
+
 // NUL-terminate all the counted strings.
 struct cmd*
 nulterminate(struct cmd *cmd)
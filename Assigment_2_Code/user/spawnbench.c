@@ -0,0 +1,96 @@
+// Measure how many two-stage pipelines ("echo x | grep zzz")
+// per second the shell can start, forking a copy of the shell
+// for each stage as runcmd() does vs. calling spawn().
+//
+// usage: spawnbench [npipelines]
+
+#include "kernel/types.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+
+char *left[] = { "echo", "x", 0 };
+char *right[] = { "grep", "zzz", 0 };
+
+// Start one stage of the pipeline with the fork/dup/exec dance.
+void
+forkstage(char **argv, int p[2], int fd)
+{
+  int pid;
+
+  pid = fork(0);
+  if(pid < 0){
+    printf("spawnbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fd);
+    dup(fd == 0 ? p[0] : p[1]);
+    close(p[0]);
+    close(p[1]);
+    exec(argv[0], argv);
+    printf("spawnbench: exec %s failed\n", argv[0]);
+    exit(1);
+  }
+}
+
+// Start one stage of the pipeline with spawn().
+void
+spawnstage(char **argv, int p[2], int fd)
+{
+  struct spawn_fa fa[3];
+
+  fa[0].op = SPAWN_DUP2;
+  fa[0].fd = fd == 0 ? p[0] : p[1];
+  fa[0].newfd = fd;
+  fa[1].op = SPAWN_CLOSE;
+  fa[1].fd = p[0];
+  fa[2].op = SPAWN_CLOSE;
+  fa[2].fd = p[1];
+  if(spawn(argv[0], argv, fa, 3) < 0){
+    printf("spawnbench: spawn %s failed\n", argv[0]);
+    exit(1);
+  }
+}
+
+void
+run(char *name, void (*stage)(char**, int*, int), int n)
+{
+  int i, p[2], t;
+
+  t = uptime();
+  for(i = 0; i < n; i++){
+    if(pipe(p) < 0){
+      printf("spawnbench: pipe failed\n");
+      exit(1);
+    }
+    stage(left, p, 1);
+    stage(right, p, 0);
+    close(p[0]);
+    close(p[1]);
+    wait(0);
+    wait(0);
+  }
+  t = uptime() - t;
+  if(t == 0)
+    t = 1;
+  // uptime() ticks are roughly 1/10th of a second.
+  printf("%s: %d pipelines in %d ticks, %d commands/sec\n",
+         name, n, t, 2 * n * 10 / t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    printf("usage: spawnbench [npipelines]\n");
+    exit(1);
+  }
+
+  run("fork+exec", forkstage, n);
+  run("spawn", spawnstage, n);
+  exit(0);
+}
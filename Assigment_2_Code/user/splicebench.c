@@ -0,0 +1,90 @@
+// splice() benchmark: send a file of nkb kilobytes down a pipe
+// to a child that reads and discards it, first with read() and
+// write() through a user buffer, then with splice(), which
+// copies straight from the buffer cache into the pipe's ring.
+//
+// usage: splicebench [nkb]
+
+#include "kernel/types.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+
+char *file = "splicebench.tmp";
+char buf[4096];
+
+void
+run(char *name, int use_splice, int nkb)
+{
+  int p[2], fd, pid, n, t, total;
+
+  if((fd = open(file, O_RDONLY)) < 0 || pipe(p) < 0){
+    printf("splicebench: open/pipe failed\n");
+    exit(1);
+  }
+  t = uptime();
+  pid = fork(0);
+  if(pid < 0){
+    printf("splicebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[1]);
+    close(fd);
+    total = 0;
+    while((n = read(p[0], buf, sizeof(buf))) > 0)
+      total += n;
+    exit(total == nkb * 1024 ? 0 : 1);
+  }
+  close(p[0]);
+  if(use_splice){
+    while((n = splice(fd, p[1], sizeof(buf))) > 0)
+      ;
+  } else {
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      if(write(p[1], buf, n) != n)
+        break;
+  }
+  close(p[1]);
+  close(fd);
+  wait(&n);
+  t = uptime() - t;
+  if(n != 0){
+    printf("splicebench: %s: child got the wrong byte count\n", name);
+    exit(1);
+  }
+  if(t == 0)
+    t = 1;
+  // uptime() ticks are roughly 1/10th of a second.
+  printf("%s: %d KB in %d ticks, %d KB/sec\n", name, nkb, t, nkb * 10 / t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, nkb = 1024;
+
+  if(argc > 1)
+    nkb = atoi(argv[1]);
+  if(nkb <= 0 || nkb > 4000){
+    printf("usage: splicebench [nkb]\n");
+    exit(1);
+  }
+
+  if((fd = open(file, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("splicebench: cannot create %s\n", file);
+    exit(1);
+  }
+  memset(buf, 's', 1024);
+  for(i = 0; i < nkb; i++){
+    if(write(fd, buf, 1024) != 1024){
+      printf("splicebench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  run("read+write", 0, nkb);
+  run("splice", 1, nkb);
+  unlink(file);
+  exit(0);
+}
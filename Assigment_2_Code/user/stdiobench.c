@@ -0,0 +1,114 @@
+// printf() benchmark: print n numbered lines to a file and to a
+// pipe, first one write() per character as printf() used to,
+// then with fprintf(), which buffers and writes STREAMBUF bytes
+// at a time.
+//
+// usage: stdiobench [nlines]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+
+char *file = "stdiobench.tmp";
+char text[] = "the quick brown fox jumps over the lazy dog";
+
+// The old unbuffered path: one system call per character.
+void
+slowline(int fd, int i)
+{
+  char num[16];
+  int j, k;
+
+  k = 0;
+  do{
+    num[k++] = '0' + i % 10;
+  }while((i /= 10) != 0);
+  while(--k >= 0)
+    write(fd, &num[k], 1);
+  write(fd, " ", 1);
+  for(j = 0; text[j]; j++)
+    write(fd, &text[j], 1);
+  write(fd, "\n", 1);
+}
+
+void
+lines(int fd, int buffered, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(buffered)
+      fprintf(fd, "%d %s\n", i, text);
+    else
+      slowline(fd, i);
+  }
+  if(buffered)
+    fflush(fd);
+}
+
+void
+tofile(char *name, int buffered, int n)
+{
+  int fd, t;
+
+  if((fd = open(file, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("stdiobench: cannot create %s\n", file);
+    exit(1);
+  }
+  t = uptime();
+  lines(fd, buffered, n);
+  close(fd);
+  t = uptime() - t;
+  printf("%s to file: %d lines in %d ticks\n", name, n, t);
+}
+
+void
+topipe(char *name, int buffered, int n)
+{
+  char buf[512];
+  int p[2], pid, t;
+
+  if(pipe(p) < 0){
+    printf("stdiobench: pipe failed\n");
+    exit(1);
+  }
+  t = uptime();
+  pid = fork(0);
+  if(pid < 0){
+    printf("stdiobench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    lines(p[1], buffered, n);
+    exit(0);
+  }
+  close(p[1]);
+  while(read(p[0], buf, sizeof(buf)) > 0)
+    ;
+  close(p[0]);
+  wait(0);
+  t = uptime() - t;
+  printf("%s to pipe: %d lines in %d ticks\n", name, n, t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 2000;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    printf("usage: stdiobench [nlines]\n");
+    exit(1);
+  }
+
+  tofile("per-char", 0, n);
+  tofile("buffered", 1, n);
+  topipe("per-char", 0, n);
+  topipe("buffered", 1, n);
+  unlink(file);
+  exit(0);
+}
@@ -1,6 +1,7 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
 #include "user/user.h"
 
 //
@@ -145,3 +146,75 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+//
+// Threads. thread_create() runs fn(arg) in a new thread that
+// shares this process's memory; thread_join() waits for it.
+// Stacks come from sbrk() and are reused once joined.
+//
+
+#define TSTACKSIZE 4096
+
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static struct {
+  int tid;       // 0 if the stack is free
+  char *stack;
+} tstacks[NTHREAD];
+
+int _exit(int) __attribute__((noreturn));  // usys.S, unwrapped
+
+static void
+thread_start(void *a)
+{
+  struct tstart *ts = a;
+
+  ts->fn(ts->arg);
+  // leave the process's printf() buffers to the process.
+  _exit(0);
+}
+
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct tstart *ts;
+  int i, tid;
+
+  for(i = 0; i < NTHREAD; i++)
+    if(tstacks[i].tid == 0)
+      break;
+  if(i == NTHREAD)
+    return -1;
+  if(tstacks[i].stack == 0){
+    char *s = sbrk(TSTACKSIZE);
+    if(s == (char*)-1)
+      return -1;
+    tstacks[i].stack = s;
+  }
+
+  // fn and arg live at the top of the new stack,
+  // just above the thread's first frame.
+  ts = (struct tstart*)(tstacks[i].stack + TSTACKSIZE) - 1;
+  ts->fn = fn;
+  ts->arg = arg;
+  if((tid = clone(thread_start, ts, ts)) < 0)
+    return -1;
+  tstacks[i].tid = tid;
+  return tid;
+}
+
+int
+thread_join(int tid)
+{
+  int i;
+
+  if((tid = join(tid)) < 0)
+    return -1;
+  for(i = 0; i < NTHREAD; i++)
+    if(tstacks[i].tid == tid)
+      tstacks[i].tid = 0;
+  return tid;
+}
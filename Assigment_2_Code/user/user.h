@@ -1,4 +1,8 @@
 struct stat;
+struct spawn_fa;
+struct iovec;
+struct bcstat;
+struct logstat;
 
 // system calls
 int fork(int);
@@ -22,6 +26,17 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int clone(void(*)(void*), void*, void*);
+int join(int);
+int spawn(const char*, char**, struct spawn_fa*, int);
+int setaffinity(int, int);
+int bcstat(struct bcstat*);
+int fsync(int);
+int logstat(struct logstat*);
+int splice(int, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int getcpu(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -31,6 +46,7 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
+int fflush(int);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
@@ -39,3 +55,5 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int thread_create(void(*)(void*), void*);
+int thread_join(int);
@@ -2571,6 +2571,1293 @@ badarg(char *s)
   exit(0);
 }
 
+// threads made by clone() share memory with their creator.
+volatile int threadval[4];
+
+void
+threadfn(void *arg)
+{
+  int i = (int)(uint64)arg;
+  threadval[i] = i + 1;
+}
+
+void
+clonetest(char *s)
+{
+  int i, tids[4];
+
+  for(i = 0; i < 4; i++){
+    if((tids[i] = thread_create(threadfn, (void*)(uint64)i)) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(thread_join(tids[i]) != tids[i]){
+      printf("%s: thread_join failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(threadval[i] != i + 1){
+      printf("%s: thread %d did not run\n", s, i);
+      exit(1);
+    }
+  }
+  if(join(0) != -1){
+    printf("%s: join with no threads succeeded\n", s);
+    exit(1);
+  }
+}
+
+volatile int clonefd;
+
+void
+openfn(void *arg)
+{
+  clonefd = open("clonefd", O_CREATE|O_RDWR);
+  chdir("clonedir");
+}
+
+void
+closefn(void *arg)
+{
+  close(clonefd);
+}
+
+// threads share the descriptor table and current directory:
+// a file one opens can be used and closed by another, and
+// chdir() in one moves them all.
+void
+clonefdtest(char *s)
+{
+  int tid, fd;
+
+  if(mkdir("clonedir") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  clonefd = -1;
+  if((tid = thread_create(openfn, 0)) < 0 || thread_join(tid) != tid){
+    printf("%s: thread failed\n", s);
+    exit(1);
+  }
+  if(clonefd < 0 || write(clonefd, "x", 1) != 1){
+    printf("%s: fd opened by a thread not usable\n", s);
+    exit(1);
+  }
+  if((fd = open("../clonefd", O_RDONLY)) < 0){
+    printf("%s: chdir by a thread not shared\n", s);
+    exit(1);
+  }
+  close(fd);
+  chdir("..");
+  if((tid = thread_create(closefn, 0)) < 0 || thread_join(tid) != tid){
+    printf("%s: thread failed\n", s);
+    exit(1);
+  }
+  if(write(clonefd, "x", 1) != -1){
+    printf("%s: fd closed by a thread still open\n", s);
+    exit(1);
+  }
+  unlink("clonefd");
+  unlink("clonedir");
+}
+
+void
+spinfn(void *arg)
+{
+  for(;;)
+    ;
+}
+
+// a process's threads die with it: once wait() has returned,
+// a thread that was still running is gone.
+void
+threadexittest(char *s)
+{
+  int p[2], pid, tid, xstatus;
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork(0);
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if((tid = thread_create(spinfn, 0)) < 0)
+      exit(1);
+    write(p[1], &tid, sizeof(tid));
+    exit(0);
+  }
+  close(p[1]);
+  if(read(p[0], &tid, sizeof(tid)) != sizeof(tid)){
+    printf("%s: thread_create failed\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child failed\n", s);
+    exit(1);
+  }
+  if(kill(tid) != -1){
+    printf("%s: thread %d outlived its process\n", s, tid);
+    exit(1);
+  }
+}
+
+// spawn() a program with its stdout redirected to a file.
+void
+spawntest(char *s)
+{
+  int fd, xstatus, pid;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[3];
+  struct spawn_fa fa[2];
+
+  unlink("echo-ok");
+  fd = open("echo-ok", O_CREATE|O_WRONLY);
+  if(fd < 0) {
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  fa[0].op = SPAWN_DUP2;
+  fa[0].fd = fd;
+  fa[0].newfd = 1;
+  fa[1].op = SPAWN_CLOSE;
+  fa[1].fd = fd;
+  if((pid = spawn("echo", echoargv, fa, 2)) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: spawned echo failed\n", s);
+    exit(1);
+  }
+
+  fd = open("echo-ok", O_RDONLY);
+  if(fd < 0) {
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if (read(fd, buf, 2) != 2) {
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("echo-ok");
+  if(buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchfile", echoargv, 0, 0) != -1){
+    printf("%s: spawn nosuchfile succeeded\n", s);
+    exit(1);
+  }
+  fa[0].op = SPAWN_CLOSE;
+  fa[0].fd = NOFILE - 1;
+  if(spawn("echo", echoargv, fa, 1) != -1){
+    printf("%s: spawn with bad fd succeeded\n", s);
+    exit(1);
+  }
+}
+
+// pin processes to CPU 0 and check they still run.
+void
+affinitytest(char *s)
+{
+  int pid, xstatus, cpu, i;
+
+  if(setaffinity(0, 0) != -1){
+    printf("%s: empty mask accepted\n", s);
+    exit(1);
+  }
+  if(setaffinity(-1, 1) != -1){
+    printf("%s: setaffinity of bad pid succeeded\n", s);
+    exit(1);
+  }
+  // pin to each CPU in turn, and check that we stay on it
+  // across the rescheduling that sleep() causes.
+  for(cpu = 0; cpu < 8; cpu++){
+    if(setaffinity(0, 1 << cpu) != 0)
+      continue;  // no such CPU
+    for(i = 0; i < 3; i++){
+      if(getcpu() != cpu){
+        printf("%s: pinned to CPU %d but ran on %d\n", s, cpu, getcpu());
+        exit(1);
+      }
+      sleep(1);
+    }
+  }
+  if(setaffinity(0, 1) != 0){
+    printf("%s: setaffinity failed\n", s);
+    exit(1);
+  }
+  pid = fork(0);
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // inherits the mask; make sure it gets to run.
+    for(int i = 0; i < 3; i++){
+      if(getcpu() != 0)
+        exit(1);
+      sleep(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(setaffinity(0, -1) != 0){
+    printf("%s: setaffinity failed\n", s);
+    exit(1);
+  }
+  if(xstatus != 0)
+    exit(1);
+}
+
+// re-reading a file should hit in the buffer cache.
+void
+bcstattest(char *s)
+{
+  struct bcstat st0, st;
+  char buf[BSIZE];
+  int fd;
+
+  fd = open("bcstat", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(bcstat(&st0) < 0){
+    printf("%s: bcstat failed\n", s);
+    exit(1);
+  }
+  fd = open("bcstat", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  bcstat(&st);
+  unlink("bcstat");
+
+  if(st.hits <= st0.hits){
+    printf("%s: no buffer cache hits\n", s);
+    exit(1);
+  }
+  if(st.nbuf < NBUF){
+    printf("%s: only %d buffers\n", s, st.nbuf);
+    exit(1);
+  }
+}
+
+// sequential reads should be read ahead, and still return
+// the right data.
+void
+readaheadtest(char *s)
+{
+  struct bcstat st0, st;
+  char buf[BSIZE/2];
+  int fd, i, j;
+
+  fd = open("readahead", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 40; i++){
+    memset(buf, 'a' + i % 26, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  bcstat(&st0);
+  fd = open("readahead", O_RDONLY);
+  for(i = 0; i < 40; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < sizeof(buf); j++){
+      if(buf[j] != 'a' + i % 26){
+        printf("%s: wrong data at %d\n", s, i * sizeof(buf) + j);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  bcstat(&st);
+  unlink("readahead");
+
+  // the file may still be cached from writing it.
+  if(st.misses - st0.misses > 2 && st.readaheads == st0.readaheads){
+    printf("%s: no readahead\n", s);
+    exit(1);
+  }
+}
+
+// fsync() must commit the open transaction before returning
+// (unless logd already has).
+void
+fsynctest(char *s)
+{
+  struct logstat st0, st;
+  int fd;
+
+  logstat(&st0);
+  fd = open("fsync", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "x", 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  logstat(&st);
+  if(st.commits == st0.commits){
+    printf("%s: fsync did not commit\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("fsync");
+  if(fsync(fd) != -1){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+}
+
+// several processes rewrite their own files and fsync() them,
+// so that commits overlap with the next transaction's writes,
+// often to the same blocks; each must read back its last data.
+void
+logoverlaptest(char *s)
+{
+  enum { NCHILD = 4, NBLK = 8, NROUND = 6 };
+  int i, pid, xstatus;
+
+  for(i = 0; i < NCHILD; i++){
+    pid = fork(0);
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      char name[] = "lov0";
+      int fd, r, b, j;
+
+      name[3] = '0' + i;
+      for(r = 0; r < NROUND; r++){
+        fd = open(name, O_CREATE|O_RDWR);
+        if(fd < 0){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+        for(b = 0; b < NBLK; b++){
+          memset(buf, 'a' + (r + b) % 26, BSIZE);
+          if(write(fd, buf, BSIZE) != BSIZE){
+            printf("%s: write %s failed\n", s, name);
+            exit(1);
+          }
+        }
+        if(r % 2 == 0 && fsync(fd) != 0){
+          printf("%s: fsync %s failed\n", s, name);
+          exit(1);
+        }
+        close(fd);
+      }
+      fd = open(name, O_RDONLY);
+      for(b = 0; b < NBLK; b++){
+        if(read(fd, buf, BSIZE) != BSIZE){
+          printf("%s: read %s failed\n", s, name);
+          exit(1);
+        }
+        for(j = 0; j < BSIZE; j++){
+          if(buf[j] != 'a' + (NROUND - 1 + b) % 26){
+            printf("%s: %s block %d has wrong data\n", s, name, b);
+            exit(1);
+          }
+        }
+      }
+      close(fd);
+      unlink(name);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+}
+
+// rewrite the same block and fsync() it many times; the
+// checkpoints must write it home fewer times than it was logged.
+void
+checkpointtest(char *s)
+{
+  struct logstat st0, st;
+  int fd, i;
+
+  fd = open("ckpt", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  logstat(&st0);
+  for(i = 0; i < 40; i++){
+    if(write(fd, "x", 1) != 1 || fsync(fd) != 0){
+      printf("%s: write/fsync failed\n", s);
+      exit(1);
+    }
+  }
+  logstat(&st);
+  close(fd);
+  unlink("ckpt");
+  if(st.checkpoints == st0.checkpoints){
+    printf("%s: log was never checkpointed\n", s);
+    exit(1);
+  }
+  if(st.installs - st0.installs >= st.blocks - st0.blocks){
+    printf("%s: checkpoints did not coalesce home writes\n", s);
+    exit(1);
+  }
+}
+
+// fill the log with many small files while children hold most
+// of memory, so that the buffer cache cannot grow and the blocks
+// the log pins crowd it. Must neither panic nor hang, and the
+// files must read back intact.
+void
+ckptmemtest(char *s)
+{
+  enum { NCHILD = 300, NPAGE = MAXRESHEAP - 1, NF = 300 };
+  struct bcstat st;
+  int ready[2], hold[2];
+  int i, n, pid, fd;
+  char name[8], c;
+
+  if(pipe(ready) < 0 || pipe(hold) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  // each child keeps NPAGE heap pages resident until hold closes;
+  // ondemand processes can keep no more than MAXRESHEAP.
+  for(n = 0; n < NCHILD; n++){
+    bcstat(&st);
+    if(st.freepages <= BCACHE_MINFREE)
+      break;
+    if((pid = fork(0)) < 0)
+      break;
+    if(pid == 0){
+      char *p;
+      close(ready[0]);
+      close(hold[1]);
+      if((p = sbrk(NPAGE * PGSIZE)) != (char*)-1)
+        for(i = 0; i < NPAGE; i++)
+          p[i * PGSIZE] = i;
+      write(ready[1], "r", 1);
+      close(ready[1]);
+      read(hold[0], &c, 1);
+      exit(0);
+    }
+    if(read(ready[0], &c, 1) != 1){
+      printf("%s: child %d failed\n", s, n);
+      exit(1);
+    }
+  }
+  close(ready[0]);
+  close(ready[1]);
+  close(hold[0]);
+
+  strcpy(name, "cm000");
+  for(i = 0; i < NF; i++){
+    name[2] = '0' + i / 100;
+    name[3] = '0' + i / 10 % 10;
+    name[4] = '0' + i % 10;
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    if(write(fd, name, sizeof(name)) != sizeof(name)){
+      printf("%s: write %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  for(i = 0; i < NF; i++){
+    name[2] = '0' + i / 100;
+    name[3] = '0' + i / 10 % 10;
+    name[4] = '0' + i % 10;
+    fd = open(name, O_RDONLY);
+    if(fd < 0 || read(fd, buf, sizeof(name)) != sizeof(name) ||
+       strcmp(buf, name) != 0){
+      printf("%s: %s did not read back\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    unlink(name);
+  }
+
+  close(hold[1]);
+  for(i = 0; i < n; i++)
+    wait(0);
+}
+
+// a single large write() should take a few transactions,
+// not one per MAXOPBLOCKS-sized chunk.
+void
+bigwritelog(char *s)
+{
+  enum { NBLK = 200 };
+  struct logstat st0, st;
+  char *p;
+  int fd;
+
+  p = malloc(NBLK * BSIZE);
+  if(p == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  memset(p, 'w', NBLK * BSIZE);
+  fd = open("bigwritelog", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  logstat(&st0);
+  if(write(fd, p, NBLK * BSIZE) != NBLK * BSIZE || fsync(fd) != 0){
+    printf("%s: write/fsync failed\n", s);
+    exit(1);
+  }
+  logstat(&st);
+  close(fd);
+  unlink("bigwritelog");
+  free(p);
+  if(st.commits - st0.commits > 10){
+    printf("%s: %d commits for a %d block write\n", s,
+           (int)(st.commits - st0.commits), NBLK);
+    exit(1);
+  }
+}
+
+// two files written a block at a time in turn end up in many
+// short extents; both must still grow past the old 268-block
+// limit and read back intact.
+void
+fragfile(char *s)
+{
+  enum { NBLK = 400 };
+  char *names[2] = { "frag0", "frag1" };
+  int fd[2], i, j, k;
+
+  for(j = 0; j < 2; j++){
+    fd[j] = open(names[j], O_CREATE|O_RDWR|O_TRUNC);
+    if(fd[j] < 0){
+      printf("%s: create %s failed\n", s, names[j]);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NBLK; i++){
+    for(j = 0; j < 2; j++){
+      ((int*)buf)[0] = i;
+      ((int*)buf)[1] = j;
+      if(write(fd[j], buf, BSIZE) != BSIZE){
+        printf("%s: write %s block %d failed\n", s, names[j], i);
+        exit(1);
+      }
+    }
+  }
+  for(j = 0; j < 2; j++){
+    close(fd[j]);
+    fd[j] = open(names[j], O_RDONLY);
+    for(i = 0; i < NBLK; i++){
+      k = read(fd[j], buf, BSIZE);
+      if(k != BSIZE || ((int*)buf)[0] != i || ((int*)buf)[1] != j){
+        printf("%s: %s block %d is wrong\n", s, names[j], i);
+        exit(1);
+      }
+    }
+    close(fd[j]);
+    unlink(names[j]);
+  }
+}
+
+// lookups must see creates, links and unlinks through the
+// directory name cache, including names that were missing
+// and directories whose inode numbers are reused.
+void
+dcachetest(char *s)
+{
+  struct stat st1, st2;
+  int fd, i;
+
+  for(i = 0; i < 2; i++){
+    if(open("dcneg", O_RDONLY) >= 0){
+      printf("%s: dcneg exists\n", s);
+      exit(1);
+    }
+    if((fd = open("dcneg", O_CREATE|O_RDWR)) < 0){
+      printf("%s: create dcneg failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    if((fd = open("dcneg", O_RDONLY)) < 0){
+      printf("%s: dcneg missing after create\n", s);
+      exit(1);
+    }
+    close(fd);
+    if(open("dclink", O_RDONLY) >= 0 || link("dcneg", "dclink") < 0 ||
+       (fd = open("dclink", O_RDONLY)) < 0){
+      printf("%s: link dclink failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    unlink("dclink");
+    unlink("dcneg");
+    if(open("dcneg", O_RDONLY) >= 0 || open("dclink", O_RDONLY) >= 0){
+      printf("%s: file still there after unlink\n", s);
+      exit(1);
+    }
+  }
+
+  if(mkdir("dcd") < 0 || (fd = open("dcd/x", O_CREATE|O_RDWR)) < 0){
+    printf("%s: mkdir dcd failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("dcd/x") < 0 || unlink("dcd") < 0){
+    printf("%s: unlink dcd failed\n", s);
+    exit(1);
+  }
+  if(mkdir("dcd2") < 0){
+    printf("%s: mkdir dcd2 failed\n", s);
+    exit(1);
+  }
+  if(open("dcd2/x", O_RDONLY) >= 0){
+    printf("%s: dcd2/x exists\n", s);
+    exit(1);
+  }
+  if(stat("dcd2/..", &st1) < 0 || stat(".", &st2) < 0 || st1.ino != st2.ino){
+    printf("%s: dcd2/.. is not the parent\n", s);
+    exit(1);
+  }
+  unlink("dcd2");
+}
+
+// dirlink() must reuse the slots that unlink() frees before
+// it grows the directory.
+void
+dirslottest(char *s)
+{
+  enum { N = 10 };
+  char name[8];
+  struct stat st0, st;
+  int i, fd;
+
+  if(mkdir("dsl") < 0){
+    printf("%s: mkdir dsl failed\n", s);
+    exit(1);
+  }
+  strcpy(name, "dsl/f0");
+  for(i = 0; i < N; i++){
+    name[5] = '0' + i;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  stat("dsl", &st0);
+  unlink("dsl/f3");
+  unlink("dsl/f7");
+  name[5] = 'a';
+  for(i = 0; i < 3; i++, name[5]++){
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    stat("dsl", &st);
+    if(st.size != st0.size + (i == 2 ? sizeof(struct dirent) : 0)){
+      printf("%s: directory size %d after %d creates\n", s, (int)st.size, i + 1);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[5] = '0' + i;
+    unlink(name);
+  }
+  for(name[5] = 'a'; name[5] < 'd'; name[5]++)
+    unlink(name);
+  if(unlink("dsl") < 0){
+    printf("%s: unlink dsl failed\n", s);
+    exit(1);
+  }
+}
+
+// a directory that outgrows a block is hashed; every entry
+// must still be found, and it must empty out again. More names
+// than four full buckets hold force splits to depth 3 or more.
+void
+hashdirtest(char *s)
+{
+  enum { N = 300 };
+  char name[8];
+  struct stat st;
+  int i, fd;
+
+  if(mkdir("hd") < 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  strcpy(name, "hd/f000");
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i / 100;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  // blocks 0 and 1 hold the header and index; the rest are buckets.
+  stat("hd", &st);
+  if(st.size / BSIZE - 2 <= 4){
+    printf("%s: directory size %d\n", s, (int)st.size);
+    exit(1);
+  }
+  for(i = 0; i < N; i += 2){
+    name[4] = '0' + i / 100;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd") == 0){
+    printf("%s: unlinked non-empty hd\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i / 100;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    fd = open(name, O_RDONLY);
+    if((fd >= 0) != (i % 2 == 1)){
+      printf("%s: open %s returned %d\n", s, name, fd);
+      exit(1);
+    }
+    if(fd >= 0)
+      close(fd);
+  }
+  for(i = 1; i < N; i += 2){
+    name[4] = '0' + i / 100;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd") < 0){
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
+// the kernel's directory hash, dirhash() in fs.c.
+static uint
+hdhash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// names that all hash to one bucket fill it; each create that
+// finds it full splits it once more, to no avail, until the
+// index reaches DIRMAXDEPTH. Then creates of such names fail
+// without growing the directory, while other names still fit.
+void
+hashdirmax(char *s)
+{
+  enum { N = BSIZE / sizeof(struct dirent) };
+  static char names[N][8];
+  char path[12];
+  struct stat st;
+  uint h0;
+  int i, n, fd;
+
+  if(mkdir("hm") < 0){
+    printf("%s: mkdir hm failed\n", s);
+    exit(1);
+  }
+  strcpy(names[0], "x00000");
+  h0 = hdhash(names[0]) & ((1 << DIRMAXDEPTH) - 1);
+  n = 1;
+  for(i = 1; i < 100000 && n < N; i++){
+    strcpy(names[n], "x00000");
+    names[n][1] = '0' + i / 10000;
+    names[n][2] = '0' + i / 1000 % 10;
+    names[n][3] = '0' + i / 100 % 10;
+    names[n][4] = '0' + i / 10 % 10;
+    names[n][5] = '0' + i % 10;
+    if((hdhash(names[n]) & ((1 << DIRMAXDEPTH) - 1)) == h0)
+      n++;
+  }
+  if(n < N){
+    printf("%s: found only %d colliding names\n", s, n);
+    exit(1);
+  }
+
+  strcpy(path, "hm/");
+  for(i = 0; i < N - 1; i++){
+    strcpy(path + 3, names[i]);
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+      printf("%s: create %s failed\n", s, path);
+      exit(1);
+    }
+    close(fd);
+  }
+  strcpy(path + 3, names[N - 1]);
+  for(i = 0; i < DIRMAXDEPTH + 2; i++){
+    if((fd = open(path, O_CREATE|O_RDWR)) >= 0){
+      printf("%s: create %s in a full bucket succeeded\n", s, path);
+      exit(1);
+    }
+  }
+  // four blocks after conversion, plus one per split from
+  // depth 1 to DIRMAXDEPTH.
+  stat("hm", &st);
+  if(st.size != (4 + DIRMAXDEPTH - 1) * BSIZE){
+    printf("%s: directory size %d\n", s, (int)st.size);
+    exit(1);
+  }
+  strcpy(path + 3, "other");
+  if((hdhash("other") & ((1 << DIRMAXDEPTH) - 1)) == h0 ||
+     (fd = open(path, O_CREATE|O_RDWR)) < 0){
+    printf("%s: create %s failed\n", s, path);
+    exit(1);
+  }
+  close(fd);
+  unlink(path);
+
+  for(i = 0; i < N - 1; i++){
+    strcpy(path + 3, names[i]);
+    if(unlink(path) < 0){
+      printf("%s: unlink %s failed\n", s, path);
+      exit(1);
+    }
+  }
+  if(unlink("hm") < 0){
+    printf("%s: unlink hm failed\n", s);
+    exit(1);
+  }
+}
+
+// file blocks are written in place rather than logged; blocks
+// freed by an uncommitted unlink must come back with the new
+// file's contents, not the old one's.
+void
+reusetest(char *s)
+{
+  enum { N = 20 };
+  char buf[BSIZE];
+  int fd, i, j, c;
+
+  for(c = 'a'; c <= 'b'; c++){
+    if((fd = open("reuse", O_CREATE|O_TRUNC|O_RDWR)) < 0){
+      printf("%s: create reuse failed\n", s);
+      exit(1);
+    }
+    memset(buf, c, sizeof(buf));
+    for(i = 0; i < N; i++){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    if(write(fd, buf, 100) != 100){
+      printf("%s: short write failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    if(c == 'a')
+      unlink("reuse");
+  }
+
+  if((fd = open("reuse", O_RDONLY)) < 0){
+    printf("%s: open reuse failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i <= N; i++){
+    int n = read(fd, buf, sizeof(buf));
+    if(n != (i < N ? sizeof(buf) : 100)){
+      printf("%s: read %d returned %d\n", s, i, n);
+      exit(1);
+    }
+    for(j = 0; j < n; j++){
+      if(buf[j] != 'b'){
+        printf("%s: block %d byte %d is %c\n", s, i, j, buf[j]);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  unlink("reuse");
+}
+
+// hold more inodes open at once than the inode table's
+// static entries; it must grow rather than panic.
+void
+manyinodes(char *s)
+{
+  enum { NCHILD = 5, PER = 12 };
+  char name[8];
+  int ready[2], go[2], i, j, pid;
+  char c;
+
+  if(pipe(ready) < 0 || pipe(go) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  strcpy(name, "mi00");
+  for(i = 0; i < NCHILD; i++){
+    pid = fork(0);
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(go[1]);
+      for(j = 0; j < PER; j++){
+        name[2] = '0' + i;
+        name[3] = 'a' + j;
+        if(open(name, O_CREATE|O_RDWR) < 0){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+      }
+      write(ready[1], "x", 1);
+      read(go[0], &c, 1);  // until the parent closes go[1]
+      exit(0);
+    }
+  }
+  close(ready[1]);
+  close(go[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], &c, 1) != 1){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  close(go[1]);
+  close(ready[0]);
+  for(i = 0; i < NCHILD; i++){
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    for(j = 0; j < PER; j++){
+      name[2] = '0' + i;
+      name[3] = 'a' + j;
+      unlink(name);
+    }
+  }
+}
+
+// writes bigger than the pipe's ring, read back in odd-sized
+// pieces, must arrive whole and in order across wraparounds.
+void
+pipebig(char *s)
+{
+  enum { N = 4, SZ = 2*4096 + 7 };
+  int fds[2], pid, xstatus;
+  int seq, i, n, cc, total;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork(0);
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  seq = 0;
+  if(pid == 0){
+    close(fds[0]);
+    for(n = 0; n < N; n++){
+      for(i = 0; i < SZ; i++)
+        buf[i] = seq++;
+      if(write(fds[1], buf, SZ) != SZ){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  total = 0;
+  cc = 1;
+  while((n = read(fds[0], buf, cc)) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (seq++ & 0xff)){
+        printf("%s: wrong byte at %d\n", s, total + i);
+        exit(1);
+      }
+    }
+    total += n;
+    cc = (cc * 3 + 1) % 5000 + 1;
+  }
+  close(fds[0]);
+  if(total != N * SZ){
+    printf("%s: total %d\n", s, total);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+}
+
+// splice a file into a pipe, the pipe into another file, and
+// that file into a third; all must match the original.
+void
+splicetest(char *s)
+{
+  enum { SZ = 5000 };
+  int fd, fd2, p[2], pid, i, n, xstatus;
+
+  if((fd = open("spl0", O_CREATE|O_TRUNC|O_RDWR)) < 0){
+    printf("%s: create spl0 failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 251;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write spl0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork(0);
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    fd = open("spl0", O_RDONLY);
+    while((n = splice(fd, p[1], 999)) > 0)
+      ;
+    exit(n < 0);
+  }
+  close(p[1]);
+  fd = open("spl1", O_CREATE|O_TRUNC|O_RDWR);
+  while((n = splice(p[0], fd, 777)) > 0)
+    ;
+  close(p[0]);
+  close(fd);
+  wait(&xstatus);
+  if(n < 0 || xstatus != 0){
+    printf("%s: splice through the pipe failed\n", s);
+    exit(1);
+  }
+
+  // from a pipe into itself: must fail rather than hang.
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(p[1], "x", 1) != 1 || splice(p[0], p[1], 1) != -1){
+    printf("%s: splice of a pipe into itself did not fail\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+
+  fd = open("spl1", O_RDONLY);
+  fd2 = open("spl2", O_CREATE|O_TRUNC|O_RDWR);
+  if(splice(fd, fd2, 2*SZ) != SZ || splice(fd, fd2, 10) != 0){
+    printf("%s: file to file splice failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fd2);
+
+  fd = open("spl2", O_RDONLY);
+  memset(buf, 0, SZ);
+  if(read(fd, buf, SZ + 1) != SZ){
+    printf("%s: spl2 has the wrong size\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < SZ; i++){
+    if((buf[i] & 0xff) != i % 251){
+      printf("%s: byte %d is wrong\n", s, i);
+      exit(1);
+    }
+  }
+  unlink("spl0");
+  unlink("spl1");
+  unlink("spl2");
+}
+
+// writev() a record from several buffers to a file and a
+// pipe, and readv() it back into differently cut buffers.
+void
+iovtest(char *s)
+{
+  char a[] = "head:", b[] = "", c[] = "body of the record;", d[] = "tail\n";
+  char want[] = "head:body of the record;tail\n";
+  char r0[3], r1[10], r2[40];
+  struct iovec w[4], r[3];
+  int fd, p[2], n, len, k;
+
+  w[0].base = a; w[0].len = strlen(a);
+  w[1].base = b; w[1].len = 0;
+  w[2].base = c; w[2].len = strlen(c);
+  w[3].base = d; w[3].len = strlen(d);
+  len = strlen(want);
+
+  for(k = 0; k < 2; k++){
+    if(k == 0){
+      if((fd = open("iov", O_CREATE|O_TRUNC|O_RDWR)) < 0){
+        printf("%s: create iov failed\n", s);
+        exit(1);
+      }
+      p[0] = p[1] = fd;
+    } else if(pipe(p) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    if(writev(p[1], w, 4) != len){
+      printf("%s: writev failed\n", s);
+      exit(1);
+    }
+    if(k == 0){
+      close(fd);
+      p[0] = open("iov", O_RDONLY);
+    }
+    memset(r2, 0, sizeof(r2));
+    r[0].base = r0; r[0].len = sizeof(r0);
+    r[1].base = r1; r[1].len = sizeof(r1);
+    r[2].base = r2; r[2].len = sizeof(r2);
+    if((n = readv(p[0], r, 3)) != len){
+      printf("%s: readv returned %d\n", s, n);
+      exit(1);
+    }
+    if(memcmp(r0, want, 3) != 0 || memcmp(r1, want+3, 10) != 0 ||
+       memcmp(r2, want+13, len-13) != 0){
+      printf("%s: readv got the wrong bytes\n", s);
+      exit(1);
+    }
+    close(p[0]);
+    if(k == 1)
+      close(p[1]);
+  }
+  unlink("iov");
+
+  w[0].len = w[1].len = 0x7fffffff;  // adds up to more than an int
+  if(writev(1, w, 2) != -1){
+    printf("%s: writev with an overflowing length succeeded\n", s);
+    exit(1);
+  }
+  w[0].len = -1;
+  if(writev(1, w, 1) != -1 || writev(1, w, IOV_MAX + 1) != -1){
+    printf("%s: bad writev succeeded\n", s);
+    exit(1);
+  }
+}
+
+// printf() to a file is buffered until fflush(), fork() or
+// close(), and none of it is lost or written twice.
+void
+stdiotest(char *s)
+{
+  struct stat st;
+  int fd, i, n, pid, xstatus;
+
+  if((fd = open("stdio", O_CREATE|O_TRUNC|O_RDWR)) < 0){
+    printf("%s: create stdio failed\n", s);
+    exit(1);
+  }
+  fprintf(fd, "abc\n");
+  if(fstat(fd, &st) < 0 || st.size != 0){
+    printf("%s: fprintf to a file was not buffered\n", s);
+    exit(1);
+  }
+  if(fflush(fd) < 0 || fstat(fd, &st) < 0 || st.size != 4){
+    printf("%s: fflush failed\n", s);
+    exit(1);
+  }
+  fprintf(fd, "xyz");
+  pid = fork(0);
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(&xstatus);
+  for(i = 0; i < 1000; i++)
+    fprintf(fd, "%d\n", i % 10);
+  close(fd);
+
+  if((fd = open("stdio", O_RDONLY)) < 0){
+    printf("%s: open stdio failed\n", s);
+    exit(1);
+  }
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  unlink("stdio");
+  if(n != 7 + 2000 || memcmp(buf, "abc\nxyz", 7) != 0){
+    printf("%s: read back %d bytes\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < 1000; i++){
+    if(buf[7+2*i] != '0' + i % 10 || buf[7+2*i+1] != '\n'){
+      printf("%s: wrong byte at %d\n", s, 7+2*i);
+      exit(1);
+    }
+  }
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2635,6 +3922,29 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {clonetest, "clonetest" },
+  {threadexittest, "threadexittest" },
+  {clonefdtest, "clonefdtest" },
+  {spawntest, "spawntest" },
+  {affinitytest, "affinitytest" },
+  {bcstattest, "bcstattest" },
+  {readaheadtest, "readaheadtest" },
+  {fsynctest, "fsynctest" },
+  {logoverlaptest, "logoverlaptest" },
+  {checkpointtest, "checkpointtest" },
+  {ckptmemtest, "ckptmemtest" },
+  {bigwritelog, "bigwritelog" },
+  {fragfile, "fragfile" },
+  {dcachetest, "dcachetest" },
+  {dirslottest, "dirslottest" },
+  {hashdirtest, "hashdirtest" },
+  {hashdirmax, "hashdirmax" },
+  {reusetest, "reusetest" },
+  {manyinodes, "manyinodes" },
+  {pipebig, "pipebig" },
+  {splicetest, "splicetest" },
+  {iovtest, "iovtest" },
+  {stdiotest, "stdiotest" },
 
   { 0, 0},
 };
@@ -6,9 +6,20 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# printf.c wraps these to flush buffered output first; the raw
+# stub is _name, and name is a weak alias for programs (forktest)
+# linked without printf.o.
+my %wrapped = map { $_ => 1 } ("fork", "exit", "close", "exec", "spawn");
+
 sub entry {
     my $name = shift;
-    print ".global $name\n";
+    if($wrapped{$name}){
+        print ".global _$name\n";
+        print "_${name}:\n";
+        print ".weak $name\n";
+    } else {
+        print ".global $name\n";
+    }
     print "${name}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
@@ -36,3 +47,14 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("clone");
+entry("join");
+entry("spawn");
+entry("setaffinity");
+entry("bcstat");
+entry("fsync");
+entry("logstat");
+entry("splice");
+entry("readv");
+entry("writev");
+entry("getcpu");